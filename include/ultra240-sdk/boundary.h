@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <ultra240-sdk/bounds.h>
+
+namespace ultra::sdk {
+
+  typedef BoundsPoint Point;
+
+  // A boundary's points in a container T, with the boundary flags written
+  // to the world.
+  template<template<typename> typename T>
+  class Boundary : public T<Point> {
+  public:
+    Boundary() : flags(0) {}
+    uint8_t flags;
+  };
+
+  // Contiguous storage for the few points of a single tile, so that seeding
+  // boundaries from tiles doesn't allocate.
+  template<typename T>
+  class InlineArray {
+  public:
+    static const size_t capacity = 4;
+
+    InlineArray() : count(0) {}
+
+    void push_back(const T& item) {
+      if (count == capacity) {
+        throw std::logic_error("InlineArray is full");
+      }
+      items[count++] = item;
+    }
+
+    const T* begin() const {
+      return items;
+    }
+
+    const T* end() const {
+      return items + count;
+    }
+
+    size_t size() const {
+      return count;
+    }
+
+  private:
+    T items[capacity];
+    size_t count;
+  };
+
+  // Place the outline of a bounds tile at tile x, y, in pixels.
+  template<template<typename> typename T>
+  Boundary<T> place_bounds_shape(
+    const BoundsShape& shape,
+    int32_t x,
+    int32_t y
+  ) {
+    Boundary<T> boundary;
+    for (const auto& point : shape) {
+      boundary.push_back({
+        .x = point.x + (x << 4),
+        .y = point.y + (y << 4),
+      });
+    }
+    return boundary;
+  }
+
+  // Append a boundary for every filled tile of a w by h bounds layer at tile
+  // x, y. Tiles hold their bounds tile code plus one, and 0 for no tile.
+  // One-way tiles are left out, as they don't join the filled shapes.
+  inline void seed_tile_boundaries(
+    const uint16_t* tiles,
+    int w,
+    int h,
+    int32_t x,
+    int32_t y,
+    std::vector<Boundary<InlineArray>>& boundaries
+  ) {
+    for (int tile_y = 0; tile_y < h; tile_y++) {
+      for (int tile_x = 0; tile_x < w; tile_x++) {
+        auto tile = tiles[tile_x + tile_y * w];
+        if (!tile || has_bounds_bits(tile - 1, BoundsTile::OneWay)) {
+          continue;
+        }
+        const auto& shape = get_bounds_shape(tile - 1);
+        if (shape.size) {
+          boundaries.push_back(place_bounds_shape<InlineArray>(
+            shape,
+            x + tile_x,
+            y + tile_y
+          ));
+        }
+      }
+    }
+  }
+
+}
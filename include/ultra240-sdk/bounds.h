@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace ultra::sdk {
+
+  // Bits of a bounds tile code, the id of the tile in a bounds tileset.
+  enum class BoundsTile : uint8_t {
+    Empty   = 0x00,
+    Slope   = 0x01,
+    Down    = 0x03,
+    Ceil    = 0x04,
+    Half    = 0x08,
+    Tall    = 0x11,
+    Solid   = 0x20,
+    OneWay  = 0x40,
+  };
+
+  constexpr BoundsTile operator|(BoundsTile a, BoundsTile b) {
+    return static_cast<BoundsTile>(
+      static_cast<uint8_t>(a) | static_cast<uint8_t>(b)
+    );
+  }
+
+  constexpr uint8_t bounds_code(BoundsTile tile) {
+    return static_cast<uint8_t>(tile);
+  }
+
+  // Whether a bounds tile code has every bit of tile.
+  constexpr bool has_bounds_bits(size_t code, BoundsTile tile) {
+    return (code & bounds_code(tile)) == bounds_code(tile);
+  }
+
+  // One more than the highest bounds tile code.
+  inline constexpr size_t bounds_tile_count = 0x80;
+
+  struct BoundsPoint {
+    int32_t x;
+    int32_t y;
+  };
+
+  // The outline of a bounds tile within its 16x16 pixels. Filled tiles are
+  // polygons, closed back to their first point, and one-way tiles are lines.
+  struct BoundsShape {
+    bool defined;
+    uint8_t size;
+    BoundsPoint points[4];
+
+    constexpr const BoundsPoint* begin() const {
+      return points;
+    }
+
+    constexpr const BoundsPoint* end() const {
+      return points + size;
+    }
+  };
+
+  constexpr std::array<BoundsShape, bounds_tile_count> make_bounds_shapes() {
+    std::array<BoundsShape, bounds_tile_count> shapes = {};
+    auto add_code = [&](
+      size_t code,
+      std::initializer_list<BoundsPoint> points
+    ) {
+      auto& shape = shapes[code];
+      shape.defined = true;
+      for (const auto& point : points) {
+        shape.points[shape.size++] = point;
+      }
+    };
+    auto add = [&](BoundsTile tile, std::initializer_list<BoundsPoint> points) {
+      add_code(bounds_code(tile), points);
+    };
+    constexpr auto Empty = BoundsTile::Empty;
+    constexpr auto Slope = BoundsTile::Slope;
+    constexpr auto Down = BoundsTile::Down;
+    constexpr auto Ceil = BoundsTile::Ceil;
+    constexpr auto Half = BoundsTile::Half;
+    constexpr auto Tall = BoundsTile::Tall;
+    constexpr auto Solid = BoundsTile::Solid;
+    constexpr auto OneWay = BoundsTile::OneWay;
+    add(Empty, {});
+    add(Solid, {{0, 0}, {16, 0}, {16, 16}, {0, 16}});
+    add(Slope, {{0, 16}, {16, 0}, {16, 16}});
+    add(Slope | Down, {{0, 0}, {16, 16}, {0, 16}});
+    add(Slope | Down | Ceil, {{0, 0}, {16, 0}, {16, 16}});
+    add(Slope | Ceil, {{0, 0}, {16, 0}, {0, 16}});
+    add(Slope | Half, {{0, 16}, {16, 8}, {16, 16}});
+    add(Slope | Half | Tall, {{0, 8}, {16, 0}, {16, 16}, {0, 16}});
+    add(Slope | Half | Tall | Down, {{0, 0}, {16, 8}, {16, 16}, {0, 16}});
+    add(Slope | Half | Down, {{0, 8}, {16, 16}, {0, 16}});
+    add(Slope | Half | Ceil, {{0, 0}, {16, 0}, {0, 8}});
+    add(Slope | Half | Ceil | Tall, {{0, 0}, {16, 0}, {16, 8}, {0, 16}});
+    add(Slope | Half | Ceil | Tall | Down, {{0, 0}, {16, 0}, {16, 16}, {0, 8}});
+    add(Slope | Half | Ceil | Down, {{0, 0}, {16, 0}, {16, 8}});
+    add(Half, {{0, 8}, {16, 8}, {16, 16}, {0, 16}});
+    add(Half | Ceil, {{0, 0}, {16, 0}, {16, 8}, {0, 8}});
+    add_code(bounds_code(OneWay | Solid) + 0, {{0, 0}, {16, 0}});
+    add_code(bounds_code(OneWay | Solid) + 1, {{16, 0}, {16, 16}});
+    add_code(bounds_code(OneWay | Solid) + 2, {{16, 16}, {0, 16}});
+    add_code(bounds_code(OneWay | Solid) + 3, {{0, 16}, {0, 0}});
+    add(OneWay | Slope, {{0, 16}, {16, 0}});
+    add(OneWay | Slope | Down, {{0, 0}, {16, 16}});
+    add(OneWay | Slope | Down | Ceil, {{16, 16}, {0, 0}});
+    add(OneWay | Slope | Ceil, {{16, 0}, {0, 16}});
+    add(OneWay | Slope | Half, {{0, 16}, {16, 8}});
+    add(OneWay | Slope | Half | Tall, {{0, 8}, {16, 0}});
+    add(OneWay | Slope | Half | Tall | Down, {{0, 0}, {16, 8}});
+    add(OneWay | Slope | Half | Down, {{0, 8}, {16, 16}});
+    add(OneWay | Slope | Half | Ceil, {{16, 0}, {0, 8}});
+    add(OneWay | Slope | Half | Ceil | Tall, {{16, 8}, {0, 16}});
+    add(OneWay | Slope | Half | Ceil | Tall | Down, {{16, 16}, {0, 8}});
+    add(OneWay | Slope | Half | Ceil | Down, {{16, 8}, {0, 0}});
+    add(OneWay | Half, {{0, 8}, {16, 8}});
+    add(OneWay | Half | Ceil, {{16, 8}, {0, 8}});
+    return shapes;
+  }
+
+  // Shapes of every bounds tile code, built at compile time.
+  inline constexpr auto bounds_shapes = make_bounds_shapes();
+
+  inline const BoundsShape& get_bounds_shape(size_t code) {
+    if (code >= bounds_tile_count || !bounds_shapes[code].defined) {
+      throw std::runtime_error("Unknown bounds tile");
+    }
+    return bounds_shapes[code];
+  }
+
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <ultra240-sdk/writer.h>
+
+namespace ultra::sdk {
+
+  // A bounding volume hierarchy over boundary segments, for finding the
+  // segments near a moving body without scanning every boundary.
+  //
+  // The section starts with the root bounds as int32_t min x, min y, max x
+  // and max y, then the uint32_t node and segment counts, the nodes and the
+  // segments. Nodes are stored depth first, so an inner node's first child
+  // follows it. Each node is:
+  //
+  //   uint16_t min_x, min_y, max_x, max_y
+  //   uint32_t data
+  //
+  // The bounds are quantized to the decoded bounds of the parent node, the
+  // root's parent bounds being the root bounds, and always contain the
+  // node's segments. The top byte of data is the number of segments in a
+  // leaf, or zero for an inner node. The rest is the index of a leaf's first
+  // segment, or of an inner node's second child.
+
+  struct BvhSegment {
+    int32_t x0, y0;
+    int32_t x1, y1;
+    // The boundary and its first point that the segment was made from.
+    uint16_t boundary;
+    uint16_t point;
+  };
+
+  struct BvhBox {
+    int32_t min_x, min_y;
+    int32_t max_x, max_y;
+  };
+
+  struct BvhNode {
+    uint16_t min_x, min_y;
+    uint16_t max_x, max_y;
+    uint32_t data;
+  };
+
+  // Build a hierarchy with at most leaf_size segments per leaf and write it.
+  void write_bvh(
+    std::vector<BvhSegment> segments,
+    size_t leaf_size,
+    Writer& writer
+  );
+
+  // Decode quantized bounds within the bounds of the parent node.
+  inline BvhBox decode_bvh_box(const BvhBox& parent, const BvhNode& node) {
+    int64_t w = static_cast<int64_t>(parent.max_x) - parent.min_x;
+    int64_t h = static_cast<int64_t>(parent.max_y) - parent.min_y;
+    // Round minimums down and maximums up.
+    return {
+      static_cast<int32_t>(parent.min_x + node.min_x * w / 0xffff),
+      static_cast<int32_t>(parent.min_y + node.min_y * h / 0xffff),
+      static_cast<int32_t>(parent.min_x + (node.max_x * w + 0xfffe) / 0xffff),
+      static_cast<int32_t>(parent.min_y + (node.max_y * h + 0xfffe) / 0xffff),
+    };
+  }
+
+  inline bool bvh_boxes_overlap(const BvhBox& a, const BvhBox& b) {
+    return a.min_x <= b.max_x && b.min_x <= a.max_x
+      && a.min_y <= b.max_y && b.min_y <= a.max_y;
+  }
+
+  // Whether two segments touch, including at their ends.
+  inline bool bvh_segments_intersect(
+    const BvhSegment& a,
+    int32_t x0,
+    int32_t y0,
+    int32_t x1,
+    int32_t y1
+  ) {
+    auto cross = [](int64_t ax, int64_t ay, int64_t bx, int64_t by,
+                    int64_t cx, int64_t cy) {
+      int64_t value = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+      return (value > 0) - (value < 0);
+    };
+    auto within = [](int64_t a, int64_t b, int64_t c) {
+      return std::min(a, b) <= c && c <= std::max(a, b);
+    };
+    int d1 = cross(x0, y0, x1, y1, a.x0, a.y0);
+    int d2 = cross(x0, y0, x1, y1, a.x1, a.y1);
+    int d3 = cross(a.x0, a.y0, a.x1, a.y1, x0, y0);
+    int d4 = cross(a.x0, a.y0, a.x1, a.y1, x1, y1);
+    if (d1 * d2 < 0 && d3 * d4 < 0) {
+      return true;
+    }
+    return (d1 == 0 && within(x0, x1, a.x0) && within(y0, y1, a.y0))
+      || (d2 == 0 && within(x0, x1, a.x1) && within(y0, y1, a.y1))
+      || (d3 == 0 && within(a.x0, a.x1, x0) && within(a.y0, a.y1, y0))
+      || (d4 == 0 && within(a.x0, a.x1, x1) && within(a.y0, a.y1, y1));
+  }
+
+  // Reference traversal of a hierarchy written by write_bvh().
+  class BvhView {
+  public:
+    // The section must stay in memory while the view is used.
+    explicit BvhView(const uint8_t* data) {
+      std::memcpy(&root, data, sizeof(root));
+      std::memcpy(&node_count, data + 16, sizeof(node_count));
+      std::memcpy(&segment_count, data + 20, sizeof(segment_count));
+      nodes = data + 24;
+      segments = nodes + node_count * sizeof(BvhNode);
+    }
+
+    size_t size() const {
+      return segment_count;
+    }
+
+    BvhSegment segment(size_t i) const {
+      BvhSegment segment;
+      std::memcpy(
+        &segment,
+        segments + i * sizeof(BvhSegment),
+        sizeof(segment)
+      );
+      return segment;
+    }
+
+    // Call visit with the index of every segment in a leaf whose bounds
+    // overlap box.
+    template<typename F>
+    void query(const BvhBox& box, F visit) const {
+      if (node_count == 0) {
+        return;
+      }
+      struct Entry {
+        uint32_t index;
+        BvhBox parent;
+      };
+      Entry stack[64];
+      size_t depth = 0;
+      stack[depth++] = {0, root};
+      while (depth > 0) {
+        auto entry = stack[--depth];
+        BvhNode node;
+        std::memcpy(
+          &node,
+          nodes + entry.index * sizeof(BvhNode),
+          sizeof(node)
+        );
+        auto bounds = decode_bvh_box(entry.parent, node);
+        if (!bvh_boxes_overlap(bounds, box)) {
+          continue;
+        }
+        uint32_t count = node.data >> 24;
+        uint32_t index = node.data & 0xffffff;
+        if (count) {
+          for (uint32_t i = 0; i < count; i++) {
+            visit(index + i);
+          }
+        } else {
+          stack[depth++] = {index, bounds};
+          stack[depth++] = {entry.index + 1, bounds};
+        }
+      }
+    }
+
+  private:
+    BvhBox root;
+    uint32_t node_count;
+    uint32_t segment_count;
+    const uint8_t* nodes;
+    const uint8_t* segments;
+  };
+
+}
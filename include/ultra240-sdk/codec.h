@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ultra::sdk {
+
+  // Lightweight compression for tile arrays, decoded one block at a time.
+  // The stream is a sequence of tokens, each starting with a control byte:
+  //
+  //   0nnnnnnn            n + 1 literal tiles follow
+  //   10nnnnnn tile       the tile repeats n + 2 times
+  //   11nnnnnn distance   copy n + 2 tiles from distance tiles back
+  //
+  // Tiles and distances are little-endian uint16_t. Copies may overlap the
+  // tiles they produce. The stream ends once the expected count is decoded.
+
+  std::vector<uint8_t> compress_tiles(const uint16_t* tiles, size_t count);
+
+  // Decode count tiles, returning the number of bytes read.
+  size_t decompress_tiles(
+    const uint8_t* data,
+    size_t size,
+    uint16_t* tiles,
+    size_t count
+  );
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ultra::sdk {
+
+  // A resident process serving one-line requests on a Unix socket and
+  // reporting changes to watched directories.
+  class Daemon {
+  public:
+    typedef std::function<std::string(const std::string&)> RequestHandler;
+
+    typedef std::function<void(const std::vector<std::string>&)>
+      ChangeHandler;
+
+    explicit Daemon(const char* socket_path);
+
+    ~Daemon();
+
+    Daemon(const Daemon&) = delete;
+
+    Daemon& operator=(const Daemon&) = delete;
+
+    // Watch a directory and its subdirectories for files being written,
+    // moved or deleted. Watching a directory again does nothing.
+    void watch(const std::string& directory);
+
+    // Serve requests until stop() is called. Each request line is answered
+    // with the line returned by handle_request. Changed paths are passed to
+    // handle_change once they have been quiet for settle_ms, and always before
+    // the next request is handled.
+    void run(
+      const RequestHandler& handle_request,
+      const ChangeHandler& handle_change,
+      int settle_ms = 100
+    );
+
+    void stop();
+
+  private:
+    void read_changes();
+
+    void serve_client(const RequestHandler& handle_request);
+
+    std::string socket_path;
+    int socket_fd;
+    int inotify_fd;
+    std::unordered_map<int, std::string> watches;
+    std::vector<std::string> changes;
+    bool running;
+  };
+
+}
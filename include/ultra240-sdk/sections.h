@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <ultra240-sdk/writer.h>
+
+namespace ultra::sdk {
+
+  // Binaries written with a section table start with section_magic, then a
+  // uint16_t version and section count, then one entry per section of
+  // uint32_t type, offset, size and flags. Sections are stored in order and
+  // offsets inside them stay relative to the start of the binary.
+
+  // "U240" in little-endian byte order.
+  inline constexpr uint32_t section_magic = 0x30343255;
+
+  // Bump when the layout of a section changes.
+  inline constexpr uint16_t section_version = 1;
+
+  enum class SectionType : uint32_t {
+    // Map, boundary, tileset, string pool, BVH and height table offsets.
+    Index = 0,
+    Maps = 1,
+    Boundaries = 2,
+    Tilesets = 3,
+    Strings = 4,
+    BoundaryBvh = 5,
+    Heights = 6,
+  };
+
+  // Format options a section was written with.
+  enum class SectionFlags : uint32_t {
+    None = 0,
+    EntityGrid = 1 << 0,
+    LayerBlocks = 1 << 1,
+    MortonBlocks = 1 << 2,
+    CompressedBlocks = 1 << 3,
+    SparseLayers = 1 << 4,
+    SharedTilesets = 1 << 5,
+    TileLookup = 1 << 6,
+    SharedTileData = 1 << 7,
+    PooledStrings = 1 << 8,
+    PartitionedBoundaries = 1 << 9,
+    CollisionGrids = 1 << 10,
+    HeightTables = 1 << 11,
+  };
+
+  constexpr SectionFlags operator|(SectionFlags a, SectionFlags b) {
+    return static_cast<SectionFlags>(
+      static_cast<uint32_t>(a) | static_cast<uint32_t>(b)
+    );
+  }
+
+  constexpr SectionFlags operator&(SectionFlags a, SectionFlags b) {
+    return static_cast<SectionFlags>(
+      static_cast<uint32_t>(a) & static_cast<uint32_t>(b)
+    );
+  }
+
+  constexpr SectionFlags& operator|=(SectionFlags& a, SectionFlags b) {
+    return a = a | b;
+  }
+
+  struct Section {
+    SectionType type;
+    uint32_t offset;
+    uint32_t size;
+    SectionFlags flags;
+  };
+
+  // Read the section table of a binary, checking its magic, version and
+  // that its sections are within size bytes.
+  std::vector<Section> read_sections(const uint8_t* data, size_t size);
+
+  class SectionTable {
+  public:
+    // Write the header of a table of count sections.
+    SectionTable(size_t count, Writer& writer);
+
+    // Start the next section at the writer's offset, ending the one before.
+    void begin(SectionType type, SectionFlags flags = SectionFlags::None);
+
+    // End the last section at the writer's offset.
+    void end();
+
+  private:
+    Writer* writer;
+    Writer::Patch<uint32_t> entries;
+    size_t count;
+    size_t index;
+    uint32_t start;
+  };
+
+}
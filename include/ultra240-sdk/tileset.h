@@ -1,9 +1,10 @@
 #pragma once
 
-#include <list>
-#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <ultra240-sdk/util.h>
+#include <ultra240-sdk/writer.h>
 #include <vector>
 
 namespace ultra::sdk {
@@ -29,44 +30,98 @@ namespace ultra::sdk {
     uint16_t spacing;
     uint16_t columns;
     std::string source;
-    std::map<uint16_t, Tile> tiles;
+    util::FlatMap<uint16_t, Tile> tiles;
     std::string library;
     bool bounds;
+    // Every name hashed while parsing, by hash.
+    util::HashMap<std::string> names;
   };
 
   Tileset read_tileset(const char* path);
 
-  void write_tileset(
+  // Parse a tileset once per process. Calls naming the same file, by any
+  // path, share one immutable Tileset until the file's contents change.
+  // The file is only read again when its timestamp or size changes.
+  std::shared_ptr<const Tileset> read_shared_tileset(const char* path);
+
+  // Offsets in a tileset header that point past the header.
+  struct TilesetPatches {
+    Writer::Patch<uint32_t> source;
+    // One entry per element of Tileset::tiles.
+    Writer::Patch<uint32_t> tiles;
+    Writer::Patch<uint32_t> library;
+    // With a lookup table, one entry per tile id below tile_count. Entries
+    // for tiles without a record are left zero.
+    Writer::Patch<uint32_t> lookup;
+  };
+
+  // With lookup, the header ends with a table of tile_count record offsets
+  // indexed by tile id, so that a tile's record is found without a search.
+  TilesetPatches write_tileset(
     const Tileset& tileset,
-    uint8_t* buf,
-    size_t* buf_size,
-    uint32_t** source_offset_entry,
-    std::list<uint32_t*>* tile_offset_entries,
-    uint32_t** library_offset_entry
+    Writer& writer,
+    bool lookup = false
   );
 
-  void write_tileset_tile(
+  // Offsets in a tile record that point past the record.
+  struct TilesetTilePatches {
+    Writer::Patch<uint32_t> library;
+    // One entry per collision box type.
+    Writer::Patch<uint32_t> collision_box_types;
+    // The animation, if it is not written inline.
+    Writer::Patch<uint32_t> animation;
+  };
+
+  // With shared_animation, the animation's frame count is followed by an
+  // offset to its frames instead of the frames themselves, so that tiles
+  // with the same animation can share one copy.
+  TilesetTilePatches write_tileset_tile(
     uint16_t tile_id,
     const Tileset::Tile& tile,
-    uint8_t* buf,
-    size_t* buf_size,
-    std::list<uint32_t*>* collision_box_type_offset_entries,
-    uint32_t** tile_library_offset_entry
+    Writer& writer,
+    bool shared_animation = false
+  );
+
+  void write_tileset_tile_animation(
+    const std::vector<Tileset::Tile::AnimationTile>& animation_tiles,
+    Writer& writer
   );
 
-  void write_tileset_tile_collision_box_type(
+  // Returns the offsets of the type's collision box lists.
+  Writer::Patch<uint32_t> write_tileset_tile_collision_box_type(
     uint32_t type,
     const util::HashMap<std::vector<Tileset::Tile::CollisionBox>>& lists,
-    uint8_t* buf,
-    size_t* buf_size,
-    std::list<uint32_t*>* collision_box_list_offset_entries
+    Writer& writer
   );
 
   void write_tileset_tile_collision_box_list(
     uint32_t name,
     const std::vector<Tileset::Tile::CollisionBox>& collision_boxes,
-    uint8_t* buf,
-    size_t* buf_size
+    Writer& writer
+  );
+
+  // Offsets of the collision box lists and animations written so far, by
+  // contents.
+  struct TileDataPool {
+    std::unordered_map<std::string, uint32_t> collision_box_lists;
+    std::unordered_map<std::string, uint32_t> animations;
+  };
+
+  // Write a collision box list unless an identical one is in the pool, and
+  // return the offset of the copy to point to.
+  uint32_t write_shared_collision_box_list(
+    uint32_t name,
+    const std::vector<Tileset::Tile::CollisionBox>& collision_boxes,
+    TileDataPool& pool,
+    Writer& writer
+  );
+
+  // Write an animation unless an identical one is in the pool, and return
+  // the offset of the copy to point to.
+  uint32_t write_shared_animation(
+    const std::vector<Tileset::Tile::AnimationTile>& animation_tiles,
+    TileDataPool& pool,
+    Writer& writer
   );
 
 }
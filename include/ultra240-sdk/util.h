@@ -1,13 +1,208 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
-#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace ultra::sdk::util {
 
+  // Associative container stored as a vector of pairs sorted by key.
+  // Iterates in key order like std::map, but keeps its elements contiguous
+  // and allocates once per growth rather than once per element. Inserting
+  // in ascending key order appends; other inserts shift the tail.
+  template<typename K, typename T>
+  class FlatMap {
+  public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<K, T> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    iterator begin() {
+      return items.begin();
+    }
+
+    iterator end() {
+      return items.end();
+    }
+
+    const_iterator begin() const {
+      return items.begin();
+    }
+
+    const_iterator end() const {
+      return items.end();
+    }
+
+    size_t size() const {
+      return items.size();
+    }
+
+    bool empty() const {
+      return items.empty();
+    }
+
+    void clear() {
+      items.clear();
+    }
+
+    void reserve(size_t count) {
+      items.reserve(count);
+    }
+
+    iterator lower_bound(const K& key) {
+      return std::lower_bound(items.begin(), items.end(), key, compare);
+    }
+
+    const_iterator lower_bound(const K& key) const {
+      return std::lower_bound(items.begin(), items.end(), key, compare);
+    }
+
+    iterator find(const K& key) {
+      auto it = lower_bound(key);
+      return it != items.end() && it->first == key ? it : items.end();
+    }
+
+    const_iterator find(const K& key) const {
+      auto it = lower_bound(key);
+      return it != items.end() && it->first == key ? it : items.end();
+    }
+
+    size_t count(const K& key) const {
+      return find(key) != items.end();
+    }
+
+    T& at(const K& key) {
+      auto it = find(key);
+      if (it == items.end()) {
+        throw std::out_of_range("FlatMap key not found");
+      }
+      return it->second;
+    }
+
+    const T& at(const K& key) const {
+      auto it = find(key);
+      if (it == items.end()) {
+        throw std::out_of_range("FlatMap key not found");
+      }
+      return it->second;
+    }
+
+    // Construct a value for key unless the key is already present.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const K& key, Args&&... args) {
+      auto it = lower_bound(key);
+      if (it != items.end() && it->first == key) {
+        return {it, false};
+      }
+      it = items.emplace(
+        it,
+        std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(std::forward<Args>(args)...)
+      );
+      return {it, true};
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+      return emplace(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+      return emplace(value.first, std::move(value.second));
+    }
+
+    T& operator[](const K& key) {
+      return emplace(key).first->second;
+    }
+
+  private:
+    static bool compare(const value_type& item, const K& key) {
+      return item.first < key;
+    }
+
+    std::vector<value_type> items;
+  };
+
   template<typename T>
-  using HashMap = std::map<uint32_t, T>;
+  using HashMap = FlatMap<uint32_t, T>;
+
+  namespace detail {
+
+    // Tables for slicing-by-8 CRC-32. Table 0 is the classic bytewise table;
+    // table k advances a byte through k further zero bytes.
+    constexpr std::array<std::array<uint32_t, 256>, 8> make_crc_tables() {
+      std::array<std::array<uint32_t, 256>, 8> tables = {};
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+          crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+        tables[0][i] = crc;
+      }
+      for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+          uint32_t prev = tables[k - 1][i];
+          tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+      }
+      return tables;
+    }
+
+    inline constexpr auto crc_tables = make_crc_tables();
+
+    constexpr uint32_t load32(std::string_view string, size_t i) {
+      return static_cast<uint32_t>(static_cast<uint8_t>(string[i]))
+        | static_cast<uint32_t>(static_cast<uint8_t>(string[i + 1])) << 8
+        | static_cast<uint32_t>(static_cast<uint8_t>(string[i + 2])) << 16
+        | static_cast<uint32_t>(static_cast<uint8_t>(string[i + 3])) << 24;
+    }
+
+  }
+
+  // Hash a name. Usable in constant expressions, so names known in advance
+  // can be hashed into constants and case labels.
+  constexpr uint32_t crc32(std::string_view string) {
+    const auto& t = detail::crc_tables;
+    uint32_t crc = 0xffffffff;
+    size_t i = 0;
+    // Fold eight bytes per step.
+    for (; i + 8 <= string.size(); i += 8) {
+      uint32_t one = detail::load32(string, i) ^ crc;
+      uint32_t two = detail::load32(string, i + 4);
+      crc = t[7][one & 0xff]
+        ^ t[6][(one >> 8) & 0xff]
+        ^ t[5][(one >> 16) & 0xff]
+        ^ t[4][one >> 24]
+        ^ t[3][two & 0xff]
+        ^ t[2][(two >> 8) & 0xff]
+        ^ t[1][(two >> 16) & 0xff]
+        ^ t[0][two >> 24];
+    }
+    for (; i < string.size(); i++) {
+      crc = (crc >> 8)
+        ^ t[0][(crc ^ static_cast<uint8_t>(string[i])) & 0xff];
+    }
+    return crc ^ 0xffffffff;
+  }
+
+  // Hash a name and record it in names. Throws if a different name with the
+  // same hash was already recorded.
+  uint32_t crc32(const char* string, HashMap<std::string>& names);
+
+  // Record every name in from in to, checking for hash collisions.
+  void merge_names(HashMap<std::string>& to, const HashMap<std::string>& from);
 
-  uint32_t crc32(const char* string);
+  // Write a C++ header with a constexpr constant for each name, in a
+  // namespace named after the header file. Debug builds also get a
+  // reverse lookup from hash to name.
+  void write_names_header(const HashMap<std::string>& names, const char* path);
 
 }
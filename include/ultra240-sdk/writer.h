@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ultra::sdk {
+
+  // Growable output buffer for serializing binaries in a single pass.
+  // Fields whose values are not known until later, such as offsets of data
+  // that has not been written yet, are reserved up front and filled in
+  // through the returned Patch handle.
+  //
+  // A Writer constructed with a path streams to that file: flush() moves
+  // the buffered bytes to the file, and patches to bytes that were already
+  // flushed are written in place.
+  class Writer {
+  public:
+    template<typename T>
+    class Patch {
+    public:
+      Patch() : writer(nullptr), offset(0) {}
+
+      // Handle for element i of a reserved array.
+      Patch operator[](size_t i) const {
+        return Patch(writer, offset + i * sizeof(T));
+      }
+
+      void set(T value) const {
+        writer->patch(offset, &value, sizeof(T));
+      }
+
+      // Set the value to an offset in the output and record where it is
+      // stored, so that the output can later be moved to another position.
+      void set_offset(uint32_t value) const {
+        static_assert(sizeof(T) == sizeof(uint32_t));
+        set(value);
+        writer->offsets.push_back(offset);
+      }
+
+      // Offset of the value in the output.
+      size_t position() const {
+        return offset;
+      }
+
+    private:
+      friend class Writer;
+
+      Patch(Writer* writer, size_t offset) : writer(writer), offset(offset) {}
+
+      Writer* writer;
+      size_t offset;
+    };
+
+    Writer();
+
+    explicit Writer(const char* path);
+
+    Writer(const Writer&) = delete;
+
+    Writer& operator=(const Writer&) = delete;
+
+    // Offset of the next byte to be written.
+    uint32_t offset() const;
+
+    // Bytes that have not been flushed.
+    const uint8_t* data() const;
+
+    // Total bytes written, including flushed bytes.
+    size_t size() const;
+
+    // Write buffered bytes to the output file, if any.
+    void flush();
+
+    // Positions of every value set with Patch::set_offset().
+    const std::vector<uint32_t>& relocations() const;
+
+    template<typename T>
+    void write(T value) {
+      write_bytes(&value, sizeof(T));
+    }
+
+    // Reserve count zeroed values of type T to be patched later.
+    template<typename T>
+    Patch<T> reserve(size_t count = 1) {
+      Patch<T> patch(this, base + buf.size());
+      buf.resize(buf.size() + count * sizeof(T));
+      return patch;
+    }
+
+    // Write a NUL-terminated string.
+    void write_string(const std::string& string);
+
+    void write_bytes(const void* data, size_t size);
+
+    void patch(size_t offset, const void* data, size_t size);
+
+  private:
+    std::vector<uint8_t> buf;
+    std::vector<uint32_t> offsets;
+    size_t base;
+    std::unique_ptr<std::ofstream> file;
+  };
+
+  // Strings written as one block at the end of an output, each stored once.
+  // A string that ends another shares its bytes.
+  class StringPool {
+  public:
+    // Set the uint32_t at position to the string's offset once the pool is
+    // written.
+    void add(size_t position, const std::string& string);
+
+    // Write the strings and set the offsets pointing to them. Returns the
+    // offset of the pool.
+    uint32_t write(Writer& writer);
+
+  private:
+    // Positions referring to each string.
+    std::unordered_map<std::string, std::vector<size_t>> refs;
+  };
+
+}
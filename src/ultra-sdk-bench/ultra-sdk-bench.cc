@@ -0,0 +1,891 @@
+/**
+ * Benchmarks runtime queries against compiled ULTRA240 binaries.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <ultra240-sdk/boundary.h>
+#include <ultra240-sdk/bounds.h>
+#include <ultra240-sdk/bvh.h>
+#include <ultra240-sdk/codec.h>
+#include <ultra240-sdk/sections.h>
+#include <ultra240-sdk/tileset.h>
+#include <ultra240-sdk/util.h>
+#include <unordered_map>
+#include <vector>
+
+struct Query {
+  int32_t x0, y0;
+  int32_t x1, y1;
+};
+
+static void print_usage(const char* self, std::ostream& out) {
+  out << "Usage: " << self << " [-h] [-n queries] [-l length] bvh <world.bin>"
+      << std::endl
+      << "         (world.bin written with section_table and boundary_bvh)"
+      << std::endl
+      << "       " << self << " bounds [size]" << std::endl
+      << "       " << self << " flatmap [tiles]" << std::endl
+      << "       " << self << " crc [count]" << std::endl
+      << "       " << self << " codec [count]" << std::endl
+      << "       " << self << " layout <cols> <rows>" << std::endl
+      << "       " << self << " [-n queries] entities <w> <h> <count>"
+      << std::endl;
+}
+
+static std::vector<uint8_t> read_binary(const char* path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(std::string("Could not open ") + path);
+  }
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+static ultra::sdk::BvhBox get_box(const Query& query) {
+  return {
+    std::min(query.x0, query.x1),
+    std::min(query.y0, query.y1),
+    std::max(query.x0, query.x1),
+    std::max(query.y0, query.y1),
+  };
+}
+
+// Time a pass over every query, returning the number of segments hit.
+template<typename F>
+static size_t run_queries(
+  const char* name,
+  const std::vector<Query>& queries,
+  F count_hits
+) {
+  auto start = std::chrono::steady_clock::now();
+  size_t hits = 0;
+  for (const auto& query : queries) {
+    hits += count_hits(query);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << static_cast<size_t>(
+    queries.size() / elapsed.count()
+  ) << " queries/s, " << hits << " hits" << std::endl;
+  return hits;
+}
+
+// Compare segment queries through the boundary BVH against a linear scan
+// over every segment.
+static int bench_bvh(const char* path, size_t count, int32_t length) {
+  auto data = read_binary(path);
+  const ultra::sdk::Section* bvh_section = nullptr;
+  auto sections = ultra::sdk::read_sections(data.data(), data.size());
+  for (const auto& section : sections) {
+    if (section.type == ultra::sdk::SectionType::BoundaryBvh) {
+      bvh_section = &section;
+    }
+  }
+  if (bvh_section == nullptr) {
+    std::cerr << "No boundary BVH section in " << path << std::endl;
+    return 1;
+  }
+  ultra::sdk::BvhView bvh(data.data() + bvh_section->offset);
+  std::vector<ultra::sdk::BvhSegment> segments;
+  segments.reserve(bvh.size());
+  ultra::sdk::BvhBox bounds = {};
+  for (size_t i = 0; i < bvh.size(); i++) {
+    segments.push_back(bvh.segment(i));
+    const auto& segment = segments.back();
+    if (i == 0) {
+      bounds = {segment.x0, segment.y0, segment.x0, segment.y0};
+    }
+    bounds.min_x = std::min({bounds.min_x, segment.x0, segment.x1});
+    bounds.min_y = std::min({bounds.min_y, segment.y0, segment.y1});
+    bounds.max_x = std::max({bounds.max_x, segment.x0, segment.x1});
+    bounds.max_y = std::max({bounds.max_y, segment.y0, segment.y1});
+  }
+  // Short moves from random points in the world.
+  std::mt19937 random(0);
+  std::uniform_int_distribution<int32_t> x(bounds.min_x, bounds.max_x);
+  std::uniform_int_distribution<int32_t> y(bounds.min_y, bounds.max_y);
+  std::uniform_int_distribution<int32_t> move(-length, length);
+  std::vector<Query> queries(count);
+  for (auto& query : queries) {
+    query.x0 = x(random);
+    query.y0 = y(random);
+    query.x1 = query.x0 + move(random);
+    query.y1 = query.y0 + move(random);
+  }
+  std::cout << segments.size() << " segments, "
+            << bvh_section->size << " byte section" << std::endl;
+  auto linear_hits = run_queries("linear", queries, [&](const Query& query) {
+    auto box = get_box(query);
+    size_t hits = 0;
+    for (const auto& segment : segments) {
+      ultra::sdk::BvhBox segment_box = {
+        std::min(segment.x0, segment.x1),
+        std::min(segment.y0, segment.y1),
+        std::max(segment.x0, segment.x1),
+        std::max(segment.y0, segment.y1),
+      };
+      if (ultra::sdk::bvh_boxes_overlap(box, segment_box)
+          && ultra::sdk::bvh_segments_intersect(
+            segment,
+            query.x0,
+            query.y0,
+            query.x1,
+            query.y1
+          )) {
+        hits++;
+      }
+    }
+    return hits;
+  });
+  auto bvh_hits = run_queries("bvh", queries, [&](const Query& query) {
+    size_t hits = 0;
+    bvh.query(get_box(query), [&](size_t i) {
+      if (ultra::sdk::bvh_segments_intersect(
+            bvh.segment(i),
+            query.x0,
+            query.y0,
+            query.x1,
+            query.y1
+          )) {
+        hits++;
+      }
+    });
+    return hits;
+  });
+  if (linear_hits != bvh_hits) {
+    std::cerr << "BVH queries missed segments" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Time seeding one boundary per tile of a square bounds layer, copying
+// shapes from a map of lists against seed_tile_boundaries(), which
+// ultra-sdk-world seeds boundaries with.
+static int bench_bounds(size_t size) {
+  // Half of the tiles are empty and the rest are random filled shapes.
+  std::vector<uint8_t> codes;
+  for (size_t code = 0; code < ultra::sdk::bounds_tile_count; code++) {
+    const auto& shape = ultra::sdk::bounds_shapes[code];
+    if (shape.defined && shape.size
+        && !ultra::sdk::has_bounds_bits(
+          code,
+          ultra::sdk::BoundsTile::OneWay
+        )) {
+      codes.push_back(code);
+    }
+  }
+  std::mt19937 random(0);
+  std::uniform_int_distribution<size_t> pick(0, codes.size() * 2 - 1);
+  std::vector<uint16_t> tiles(size * size);
+  for (auto& tile : tiles) {
+    auto i = pick(random);
+    tile = i < codes.size() ? codes[i] + 1 : 0;
+  }
+  std::unordered_map<uint8_t, std::list<ultra::sdk::BoundsPoint>> geometry;
+  for (size_t code = 0; code < ultra::sdk::bounds_tile_count; code++) {
+    const auto& shape = ultra::sdk::bounds_shapes[code];
+    if (shape.defined) {
+      geometry[code].assign(shape.begin(), shape.end());
+    }
+  }
+  std::cout << size << "x" << size << " tiles" << std::endl;
+  auto run = [&](const char* name, auto seed) {
+    auto start = std::chrono::steady_clock::now();
+    auto count = seed();
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() << " ms, " << count
+              << " boundaries" << std::endl;
+    return count;
+  };
+  std::list<ultra::sdk::Boundary<std::list>> list_boundaries;
+  std::vector<ultra::sdk::Boundary<ultra::sdk::InlineArray>> inline_boundaries;
+  run("list", [&]() {
+    for (size_t y = 0; y < size; y++) {
+      for (size_t x = 0; x < size; x++) {
+        auto tile = tiles[x + y * size];
+        if (tile) {
+          auto geo = geometry.at(tile - 1);
+          if (geo.size()) {
+            ultra::sdk::Boundary<std::list> points;
+            for (auto& point : geo) {
+              point.x += x << 4;
+              point.y += y << 4;
+              points.push_back(point);
+            }
+            list_boundaries.push_back(points);
+          }
+        }
+      }
+    }
+    return list_boundaries.size();
+  });
+  run("inline", [&]() {
+    ultra::sdk::seed_tile_boundaries(
+      tiles.data(),
+      size,
+      size,
+      0,
+      0,
+      inline_boundaries
+    );
+    return inline_boundaries.size();
+  });
+  auto same_points = [](const auto& a, const auto& b) {
+    return std::equal(
+      a.begin(),
+      a.end(),
+      b.begin(),
+      b.end(),
+      [](const auto& p, const auto& q) { return p.x == q.x && p.y == q.y; }
+    );
+  };
+  if (!std::equal(
+        list_boundaries.begin(),
+        list_boundaries.end(),
+        inline_boundaries.begin(),
+        inline_boundaries.end(),
+        same_points
+      )) {
+    std::cerr << "Seeding produced different boundaries" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// A tile as stored before Tileset switched to util::FlatMap.
+struct MapTile {
+  uint32_t name;
+  std::map<
+    uint32_t,
+    std::map<uint32_t, std::vector<ultra::sdk::Tileset::Tile::CollisionBox>>
+  > collision_boxes;
+  std::vector<ultra::sdk::Tileset::Tile::AnimationTile> animation_tiles;
+  std::string library;
+};
+
+// Fill a tileset's tiles with three collision boxes of two types and two
+// animation frames each.
+template<typename Tiles>
+static void add_annotated_tiles(Tiles& tiles, size_t count) {
+  static constexpr uint32_t types[] = {
+    ultra::sdk::util::crc32("solid"),
+    ultra::sdk::util::crc32("hurt"),
+  };
+  static constexpr uint32_t names[] = {
+    ultra::sdk::util::crc32("body"),
+    ultra::sdk::util::crc32("feet"),
+    ultra::sdk::util::crc32("head"),
+  };
+  for (size_t id = 0; id < count; id++) {
+    auto& tile = tiles[id];
+    tile.name = ultra::sdk::util::crc32("tile" + std::to_string(id));
+    for (size_t i = 0; i < 3; i++) {
+      uint16_t offset = (id + i) % 8;
+      tile.collision_boxes[types[i % 2]][names[i]].push_back({
+        offset,
+        offset,
+        static_cast<uint16_t>(16 - offset),
+        static_cast<uint16_t>(16 - offset),
+      });
+    }
+    tile.animation_tiles.push_back({static_cast<uint16_t>(id), 100});
+    tile.animation_tiles.push_back({static_cast<uint16_t>(id + 1), 100});
+  }
+}
+
+// Visit every collision box in order, as serialization does.
+template<typename Tiles>
+static uint64_t sum_annotated_tiles(const Tiles& tiles) {
+  uint64_t sum = 0;
+  for (const auto& [id, tile] : tiles) {
+    sum = sum * 31 + id + tile.name;
+    for (const auto& [type, boxes_by_name] : tile.collision_boxes) {
+      for (const auto& [name, boxes] : boxes_by_name) {
+        for (const auto& box : boxes) {
+          sum = sum * 31 + type + name + box.x + box.y + box.w + box.h;
+        }
+      }
+    }
+    for (const auto& frame : tile.animation_tiles) {
+      sum = sum * 31 + frame.tile_id + frame.duration;
+    }
+  }
+  return sum;
+}
+
+// Time building, traversing and searching the tiles of a tileset with count
+// annotated tiles, stored in std::map against Tileset's util::FlatMap.
+static int bench_flatmap(size_t count) {
+  std::cout << count << " annotated tiles" << std::endl;
+  auto run = [&](const char* name, auto tiles) {
+    auto start = std::chrono::steady_clock::now();
+    add_annotated_tiles(tiles, count);
+    auto built = std::chrono::steady_clock::now();
+    auto sum = sum_annotated_tiles(tiles);
+    auto traversed = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t id = 0; id < count; id++) {
+      found += tiles.find(id) != tiles.end();
+    }
+    auto searched = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::milli> build = built - start;
+    std::chrono::duration<double, std::milli> traverse = traversed - built;
+    std::chrono::duration<double, std::milli> search = searched - traversed;
+    std::cout << name << ": build " << build.count() << " ms, traverse "
+              << traverse.count() << " ms, " << found << " finds "
+              << search.count() << " ms" << std::endl;
+    return sum;
+  };
+  auto map_sum = run("std::map", std::map<uint16_t, MapTile>());
+  auto flat_sum = run(
+    "FlatMap",
+    ultra::sdk::util::FlatMap<uint16_t, ultra::sdk::Tileset::Tile>()
+  );
+  if (map_sum != flat_sum) {
+    std::cerr << "Tiles differ between std::map and FlatMap" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// CRC-32 one byte at a time, as names were hashed before slicing-by-8.
+static uint32_t crc32_bytewise(std::string_view string) {
+  const auto& table = ultra::sdk::util::detail::crc_tables[0];
+  uint32_t crc = 0xffffffff;
+  for (char c : string) {
+    crc = (crc >> 8) ^ table[(crc ^ static_cast<uint8_t>(c)) & 0xff];
+  }
+  return crc ^ 0xffffffff;
+}
+
+// Time hashing random names with util::crc32 against the bytewise loop.
+static int bench_crc(size_t count) {
+  // Lengths from short property names to long entity states.
+  std::mt19937 random(0);
+  std::uniform_int_distribution<size_t> length(4, 48);
+  std::uniform_int_distribution<int> letter('a', 'z');
+  std::vector<std::string> names(count);
+  size_t bytes = 0;
+  for (auto& name : names) {
+    name.resize(length(random));
+    for (auto& c : name) {
+      c = static_cast<char>(letter(random));
+    }
+    bytes += name.size();
+  }
+  std::cout << count << " names, " << bytes << " bytes" << std::endl;
+  auto run = [&](const char* name, auto hash) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t sum = 0;
+    for (const auto& string : names) {
+      sum = sum * 31 + hash(string);
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() * 1000 << " ms, "
+              << static_cast<size_t>(bytes / elapsed.count() / 1000000)
+              << " MB/s" << std::endl;
+    return sum;
+  };
+  auto bytewise_sum = run("bytewise", crc32_bytewise);
+  auto sliced_sum = run("slicing-by-8", [](std::string_view string) {
+    return ultra::sdk::util::crc32(string);
+  });
+  if (bytewise_sum != sliced_sum) {
+    std::cerr << "Hashes differ from the bytewise CRC-32" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Round-trip 16x16 blocks of each kind of layer through the tile codec,
+// timing decoding and checking that truncated streams are rejected.
+static int bench_codec(size_t count) {
+  constexpr size_t block_size = 16 * 16;
+  std::mt19937 random(0);
+  std::uniform_int_distribution<uint16_t> tile(1, 1023);
+  std::uniform_int_distribution<int> percent(0, 99);
+  auto generate = [&](const char* kind, uint16_t* block) {
+    std::string_view name(kind);
+    if (name == "random") {
+      for (size_t i = 0; i < block_size; i++) {
+        block[i] = tile(random);
+      }
+    } else if (name == "sparse") {
+      for (size_t i = 0; i < block_size; i++) {
+        block[i] = percent(random) < 10 ? tile(random) : 0;
+      }
+    } else {
+      // Ground below a random height, platforms and a repeating backdrop.
+      uint16_t ground = tile(random);
+      uint16_t platform = tile(random);
+      uint16_t backdrop = tile(random);
+      size_t height = 8 + percent(random) % 8;
+      for (size_t y = 0; y < 16; y++) {
+        size_t start = percent(random) % 12;
+        for (size_t x = 0; x < 16; x++) {
+          uint16_t value = 0;
+          if (y >= height) {
+            value = ground;
+          } else if (y % 4 == 3 && x >= start && x < start + 4) {
+            value = platform;
+          } else if (y < 4) {
+            value = backdrop + (x % 4);
+          }
+          block[x + y * 16] = value;
+        }
+      }
+    }
+  };
+  std::cout << count << " blocks of " << block_size << " tiles" << std::endl;
+  for (const char* kind : {"random", "sparse", "level"}) {
+    std::vector<uint16_t> tiles(count * block_size);
+    std::vector<std::vector<uint8_t>> packed(count);
+    size_t packed_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+      generate(kind, &tiles[i * block_size]);
+      packed[i] = ultra::sdk::compress_tiles(
+        &tiles[i * block_size],
+        block_size
+      );
+      packed_bytes += packed[i].size();
+    }
+    std::vector<uint16_t> decoded(count * block_size);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+      ultra::sdk::decompress_tiles(
+        packed[i].data(),
+        packed[i].size(),
+        &decoded[i * block_size],
+        block_size
+      );
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    size_t raw_bytes = tiles.size() * sizeof(uint16_t);
+    std::cout << kind << ": " << raw_bytes << " B to " << packed_bytes
+              << " B, " << static_cast<double>(raw_bytes) / packed_bytes
+              << "x, decode " << static_cast<size_t>(
+                raw_bytes / elapsed.count() / 1000000
+              ) << " MB/s" << std::endl;
+    if (decoded != tiles) {
+      std::cerr << "Decoded " << kind << " tiles differ" << std::endl;
+      return 1;
+    }
+    // Every prefix of a stream is missing tiles.
+    std::vector<uint16_t> block(block_size);
+    for (size_t size = 0; size < packed[0].size(); size++) {
+      try {
+        ultra::sdk::decompress_tiles(
+          packed[0].data(),
+          size,
+          block.data(),
+          block.size()
+        );
+      } catch (const std::runtime_error&) {
+        continue;
+      }
+      std::cerr << "Truncated " << kind << " stream decoded" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// A layer's tiles laid out as written by ultra-sdk-world, with the byte
+// offset of every tile.
+struct TileLayout {
+  const char* name;
+  std::vector<uint8_t> data;
+  std::function<size_t(uint32_t, uint32_t)> tile_offset;
+  std::function<size_t(uint32_t, uint32_t)> table_offset;
+};
+
+static uint32_t interleave(uint32_t x, uint32_t y) {
+  uint32_t code = 0;
+  for (int bit = 0; bit < 16; bit++) {
+    code |= ((x >> bit) & 1u) << (bit * 2);
+    code |= ((y >> bit) & 1u) << (bit * 2 + 1);
+  }
+  return code;
+}
+
+// Lay out a layer in 16x16 blocks after a row-major table of block offsets,
+// in row-major or Morton order, as with the layer_blocks config option.
+static TileLayout make_block_layout(
+  const char* name,
+  const std::vector<uint16_t>& tiles,
+  uint32_t w,
+  uint32_t h,
+  bool morton
+) {
+  constexpr uint32_t size = 16;
+  uint32_t cols = (w + size - 1) / size;
+  uint32_t rows = (h + size - 1) / size;
+  std::vector<uint32_t> order(cols * rows);
+  for (uint32_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  if (morton) {
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return interleave(a % cols, a / cols) < interleave(b % cols, b / cols);
+    });
+  }
+  size_t table_size = order.size() * sizeof(uint32_t);
+  std::vector<size_t> block_offsets(order.size());
+  for (uint32_t i = 0; i < order.size(); i++) {
+    block_offsets[order[i]] = table_size + i * size * size * sizeof(uint16_t);
+  }
+  TileLayout layout;
+  layout.name = name;
+  layout.data.resize(table_size + order.size() * size * size * 2);
+  layout.tile_offset = [=](uint32_t x, uint32_t y) {
+    auto i = x / size + y / size * cols;
+    return block_offsets[i] + (x % size + y % size * size) * sizeof(uint16_t);
+  };
+  layout.table_offset = [=](uint32_t x, uint32_t y) {
+    return (x / size + y / size * cols) * sizeof(uint32_t);
+  };
+  for (uint32_t y = 0; y < h; y++) {
+    for (uint32_t x = 0; x < w; x++) {
+      std::memcpy(
+        &layout.data[layout.tile_offset(x, y)],
+        &tiles[x + y * w],
+        sizeof(uint16_t)
+      );
+    }
+  }
+  return layout;
+}
+
+// Sweep a 256x240 viewport across a random layer of cols by rows tiles at
+// 4 pixels per frame, horizontally and then vertically, and count the bytes,
+// cache lines and pages each layout reads per frame.
+static int bench_layout(uint32_t w, uint32_t h) {
+  constexpr uint32_t view_w = 256;
+  constexpr uint32_t view_h = 240;
+  if (w * 16 < view_w || h * 16 < view_h) {
+    std::cerr << "Layer is smaller than the viewport" << std::endl;
+    return 1;
+  }
+  std::mt19937 random(0);
+  std::uniform_int_distribution<uint16_t> tile(0, 1023);
+  std::vector<uint16_t> tiles(w * h);
+  for (auto& value : tiles) {
+    value = tile(random);
+  }
+  TileLayout rows;
+  rows.name = "rows";
+  rows.data.resize(tiles.size() * sizeof(uint16_t));
+  std::memcpy(rows.data.data(), tiles.data(), rows.data.size());
+  rows.tile_offset = [=](uint32_t x, uint32_t y) {
+    return (x + y * w) * sizeof(uint16_t);
+  };
+  std::vector<TileLayout> layouts;
+  layouts.push_back(std::move(rows));
+  layouts.push_back(make_block_layout("blocks", tiles, w, h, false));
+  layouts.push_back(make_block_layout("morton", tiles, w, h, true));
+  std::cout << w << "x" << h << " tiles" << std::endl;
+  std::vector<uint64_t> sums;
+  for (bool horizontal : {true, false}) {
+    uint32_t end = horizontal ? w * 16 - view_w : h * 16 - view_h;
+    for (const auto& layout : layouts) {
+      size_t frames = 0;
+      size_t bytes = 0;
+      size_t lines = 0;
+      size_t pages = 0;
+      uint64_t sum = 0;
+      std::set<size_t> frame_lines;
+      std::set<size_t> frame_pages;
+      auto read = [&](size_t offset, size_t size) {
+        bytes += size;
+        for (size_t line = offset / 64; line <= (offset + size - 1) / 64;
+             line++) {
+          frame_lines.insert(line);
+          frame_pages.insert(line * 64 / 4096);
+        }
+      };
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t pos = 0; pos <= end; pos += 4, frames++) {
+        uint32_t left = horizontal ? pos : 0;
+        uint32_t top = horizontal ? 0 : pos;
+        uint32_t x0 = left / 16;
+        uint32_t x1 = (left + view_w - 1) / 16;
+        uint32_t y0 = top / 16;
+        uint32_t y1 = (top + view_h - 1) / 16;
+        frame_lines.clear();
+        frame_pages.clear();
+        for (uint32_t y = y0; y <= y1; y++) {
+          for (uint32_t x = x0; x <= x1; x++) {
+            uint16_t value;
+            auto offset = layout.tile_offset(x, y);
+            std::memcpy(&value, &layout.data[offset], sizeof(value));
+            sum += value;
+            read(offset, sizeof(value));
+            // Blocks are found through the table.
+            if (layout.table_offset
+                && (x == x0 || x % 16 == 0) && (y == y0 || y % 16 == 0)) {
+              read(layout.table_offset(x, y), sizeof(uint32_t));
+            }
+          }
+        }
+        lines += frame_lines.size();
+        pages += frame_pages.size();
+      }
+      std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+      std::cout << (horizontal ? "horizontal " : "vertical ") << layout.name
+                << ": " << bytes / frames << " bytes, "
+                << static_cast<double>(lines) / frames << " lines, "
+                << static_cast<double>(pages) / frames << " pages per frame, "
+                << elapsed.count() << " ms" << std::endl;
+      sums.push_back(sum);
+    }
+    if (sums[sums.size() - 1] != sums[sums.size() - 3]
+        || sums[sums.size() - 2] != sums[sums.size() - 3]) {
+      std::cerr << "Layouts read different tiles" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+struct EntityBox {
+  int32_t x, y;
+  int32_t w, h;
+};
+
+// Time camera queries against random entities on a map of w by h pixels,
+// through the x-sorted index arrays against the entity_grid cells.
+static int bench_entities(
+  int32_t w,
+  int32_t h,
+  size_t entity_count,
+  size_t count
+) {
+  constexpr int32_t view_w = 384;
+  constexpr int32_t view_h = 240;
+  if (w < view_w || h < view_h || entity_count > 65535) {
+    std::cerr << "Map is smaller than the camera or has too many entities"
+              << std::endl;
+    return 1;
+  }
+  std::mt19937 random(0);
+  std::uniform_int_distribution<int32_t> x(0, w - 1);
+  std::uniform_int_distribution<int32_t> y(0, h - 1);
+  std::uniform_int_distribution<int32_t> size(8, 64);
+  std::vector<EntityBox> entities(entity_count);
+  for (auto& entity : entities) {
+    entity = {x(random), y(random), size(random), size(random)};
+  }
+  // Indexes sorted by left and right edge, as in every map record.
+  std::vector<uint16_t> x_sorted_min(entity_count);
+  for (size_t i = 0; i < entity_count; i++) {
+    x_sorted_min[i] = i;
+  }
+  auto x_sorted_max = x_sorted_min;
+  std::sort(x_sorted_min.begin(), x_sorted_min.end(), [&](auto a, auto b) {
+    return entities[a].x < entities[b].x;
+  });
+  std::sort(x_sorted_max.begin(), x_sorted_max.end(), [&](auto a, auto b) {
+    return entities[a].x + entities[a].w < entities[b].x + entities[b].w;
+  });
+  // Screen-sized cells listing the entities overlapping them, as written by
+  // ultra-sdk-world with entity_grid.
+  int32_t cols = (w + view_w - 1) / view_w;
+  int32_t rows = (h + view_h - 1) / view_h;
+  std::vector<std::vector<uint16_t>> cell_lists(cols * rows);
+  for (size_t i = 0; i < entity_count; i++) {
+    const auto& entity = entities[i];
+    int32_t col_max = std::min((entity.x + entity.w - 1) / view_w, cols - 1);
+    int32_t row_max = std::min((entity.y + entity.h - 1) / view_h, rows - 1);
+    for (int32_t row = entity.y / view_h; row <= row_max; row++) {
+      for (int32_t col = entity.x / view_w; col <= col_max; col++) {
+        cell_lists[col + row * cols].push_back(i);
+      }
+    }
+  }
+  std::vector<uint32_t> cell_starts;
+  std::vector<uint16_t> cell_indexes;
+  for (const auto& cell : cell_lists) {
+    cell_starts.push_back(cell_indexes.size());
+    cell_indexes.insert(cell_indexes.end(), cell.begin(), cell.end());
+  }
+  cell_starts.push_back(cell_indexes.size());
+  std::uniform_int_distribution<int32_t> camera_x(0, w - view_w);
+  std::uniform_int_distribution<int32_t> camera_y(0, h - view_h);
+  std::vector<Query> queries(count);
+  for (auto& query : queries) {
+    query.x0 = camera_x(random);
+    query.y0 = camera_y(random);
+    query.x1 = query.x0 + view_w;
+    query.y1 = query.y0 + view_h;
+  }
+  std::cout << w << "x" << h << " pixels, " << entity_count << " entities, "
+            << cols << "x" << rows << " cells" << std::endl;
+  auto overlaps = [&](uint16_t i, const Query& query) {
+    const auto& entity = entities[i];
+    return entity.x < query.x1 && entity.x + entity.w > query.x0
+      && entity.y < query.y1 && entity.y + entity.h > query.y0;
+  };
+  // Stamps mark entities already seen by the current query.
+  std::vector<uint32_t> stamps(entity_count);
+  uint32_t stamp = 0;
+  auto linear_hits = run_queries("linear", queries, [&](const Query& query) {
+    size_t hits = 0;
+    for (size_t i = 0; i < entity_count; i++) {
+      hits += overlaps(i, query);
+    }
+    return hits;
+  });
+  auto sorted_hits = run_queries("sorted", queries, [&](const Query& query) {
+    // Entities starting left of the camera's right edge, and entities
+    // ending right of its left edge. Scan the smaller side, and test the
+    // entities it shares with the other side.
+    size_t starts = std::lower_bound(
+      x_sorted_min.begin(),
+      x_sorted_min.end(),
+      query.x1,
+      [&](uint16_t i, int32_t x) { return entities[i].x < x; }
+    ) - x_sorted_min.begin();
+    size_t ends = x_sorted_max.end() - std::upper_bound(
+      x_sorted_max.begin(),
+      x_sorted_max.end(),
+      query.x0,
+      [&](int32_t x, uint16_t i) { return x < entities[i].x + entities[i].w; }
+    );
+    size_t hits = 0;
+    stamp++;
+    if (starts < ends) {
+      for (size_t i = 0; i < starts; i++) {
+        stamps[x_sorted_min[i]] = stamp;
+      }
+      for (size_t i = entity_count - ends; i < entity_count; i++) {
+        auto entity = x_sorted_max[i];
+        hits += stamps[entity] == stamp && overlaps(entity, query);
+      }
+    } else {
+      for (size_t i = entity_count - ends; i < entity_count; i++) {
+        stamps[x_sorted_max[i]] = stamp;
+      }
+      for (size_t i = 0; i < starts; i++) {
+        auto entity = x_sorted_min[i];
+        hits += stamps[entity] == stamp && overlaps(entity, query);
+      }
+    }
+    return hits;
+  });
+  auto grid_hits = run_queries("grid", queries, [&](const Query& query) {
+    size_t hits = 0;
+    stamp++;
+    int32_t col_max = std::min((query.x1 - 1) / view_w, cols - 1);
+    int32_t row_max = std::min((query.y1 - 1) / view_h, rows - 1);
+    for (int32_t row = query.y0 / view_h; row <= row_max; row++) {
+      for (int32_t col = query.x0 / view_w; col <= col_max; col++) {
+        auto cell = col + row * cols;
+        for (auto i = cell_starts[cell]; i < cell_starts[cell + 1]; i++) {
+          auto entity = cell_indexes[i];
+          if (stamps[entity] != stamp) {
+            stamps[entity] = stamp;
+            hits += overlaps(entity, query);
+          }
+        }
+      }
+    }
+    return hits;
+  });
+  if (sorted_hits != linear_hits || grid_hits != linear_hits) {
+    std::cerr << "Entity queries missed entities" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Run the benchmark named by the first argument.
+static int run_bench(
+  const char* self,
+  const std::vector<const char*>& args,
+  size_t count,
+  int32_t length
+) {
+  if (args.size() >= 1 && args.size() <= 2
+      && std::string(args[0]) == "bounds") {
+    return bench_bounds(args.size() == 2 ? std::atoi(args[1]) : 1000);
+  }
+  if (args.size() >= 1 && args.size() <= 2
+      && std::string(args[0]) == "flatmap") {
+    return bench_flatmap(args.size() == 2 ? std::atoi(args[1]) : 4096);
+  }
+  if (args.size() >= 1 && args.size() <= 2
+      && std::string(args[0]) == "crc") {
+    return bench_crc(args.size() == 2 ? std::atoi(args[1]) : 1000000);
+  }
+  if (args.size() >= 1 && args.size() <= 2
+      && std::string(args[0]) == "codec") {
+    return bench_codec(args.size() == 2 ? std::atoi(args[1]) : 10000);
+  }
+  if (args.size() == 3 && std::string(args[0]) == "layout") {
+    return bench_layout(std::atoi(args[1]), std::atoi(args[2]));
+  }
+  if (args.size() == 4 && std::string(args[0]) == "entities") {
+    return bench_entities(
+      std::atoi(args[1]),
+      std::atoi(args[2]),
+      std::atoi(args[3]),
+      count
+    );
+  }
+  if (args.size() != 2 || std::string(args[0]) != "bvh") {
+    print_usage(self, std::cerr);
+    return 1;
+  }
+  return bench_bvh(args[1], count, length);
+}
+
+int main(int argc, const char* argv[]) {
+  // Check for help option.
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      print_usage(argv[0], std::cout);
+      return 0;
+    }
+  }
+  // Check for query count and length options.
+  size_t count = 10000;
+  int32_t length = 32;
+  std::vector<const char*> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc) {
+      count = std::atoi(argv[++i]);
+    } else if (arg == "-l" && i + 1 < argc) {
+      length = std::atoi(argv[++i]);
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      print_usage(argv[0], std::cerr);
+      return 1;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  try {
+    return run_bench(argv[0], args, count, length);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,197 @@
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <ultra240-sdk/daemon.h>
+#include <unistd.h>
+
+namespace ultra::sdk {
+
+  static std::runtime_error system_error(const std::string& message) {
+    return std::runtime_error(message + ": " + std::strerror(errno));
+  }
+
+  Daemon::Daemon(const char* socket_path)
+    : socket_path(socket_path),
+      socket_fd(-1),
+      inotify_fd(-1),
+      running(false) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (this->socket_path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("Socket path too long");
+    }
+    std::strcpy(addr.sun_path, socket_path);
+    socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) {
+      throw system_error("Could not create socket");
+    }
+    // Replace a socket left behind by a daemon that did not exit cleanly,
+    // but not one that a running daemon still answers on.
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+      int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (probe_fd == -1) {
+        auto error = system_error("Could not create socket");
+        close(socket_fd);
+        throw error;
+      }
+      int connected = connect(
+        probe_fd,
+        reinterpret_cast<sockaddr*>(&addr),
+        sizeof(addr)
+      );
+      int connect_errno = errno;
+      close(probe_fd);
+      if (connected == 0) {
+        close(socket_fd);
+        throw std::runtime_error(
+          "A daemon is already listening on " + this->socket_path
+        );
+      }
+      if (connect_errno == ECONNREFUSED) {
+        unlink(socket_path);
+      }
+    }
+    if (bind(socket_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+        || listen(socket_fd, 8)) {
+      auto error = system_error("Could not listen on socket");
+      close(socket_fd);
+      throw error;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+      auto error = system_error("Could not watch files");
+      close(socket_fd);
+      unlink(socket_path);
+      throw error;
+    }
+  }
+
+  Daemon::~Daemon() {
+    close(inotify_fd);
+    close(socket_fd);
+    unlink(socket_path.c_str());
+  }
+
+  void Daemon::watch(const std::string& directory) {
+    int wd = inotify_add_watch(
+      inotify_fd,
+      directory.c_str(),
+      IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE
+        | IN_ONLYDIR
+    );
+    if (wd == -1) {
+      throw system_error("Could not watch " + directory);
+    }
+    // Watch subdirectories too, the first time a directory is watched.
+    if (!watches.emplace(wd, directory).second) {
+      return;
+    }
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+    while (auto entry = readdir(dir)) {
+      std::string name(entry->d_name);
+      if (entry->d_type == DT_DIR && name != "." && name != "..") {
+        watch(directory + "/" + name);
+      }
+    }
+    closedir(dir);
+  }
+
+  void Daemon::run(
+    const RequestHandler& handle_request,
+    const ChangeHandler& handle_change,
+    int settle_ms
+  ) {
+    running = true;
+    while (running) {
+      pollfd fds[2] = {};
+      fds[0].fd = socket_fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = inotify_fd;
+      fds[1].events = POLLIN;
+      int ready = poll(fds, 2, changes.empty() ? -1 : settle_ms);
+      if (ready == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw system_error("Could not poll");
+      }
+      if (fds[1].revents & POLLIN) {
+        read_changes();
+      }
+      // Report changes that have settled, or that a request should see.
+      bool request = fds[0].revents & POLLIN;
+      if (!changes.empty() && (ready == 0 || request)) {
+        auto changed = std::move(changes);
+        changes.clear();
+        handle_change(changed);
+      }
+      if (request) {
+        serve_client(handle_request);
+      }
+    }
+  }
+
+  void Daemon::stop() {
+    running = false;
+  }
+
+  void Daemon::read_changes() {
+    alignas(inotify_event) char buf[4096];
+    ssize_t size;
+    while ((size = read(inotify_fd, buf, sizeof(buf))) > 0) {
+      for (char* ptr = buf; ptr < buf + size; ) {
+        auto event = reinterpret_cast<const inotify_event*>(ptr);
+        ptr += sizeof(inotify_event) + event->len;
+        auto dir = watches.find(event->wd);
+        if (dir == watches.end() || event->len == 0) {
+          continue;
+        }
+        auto path = dir->second + "/" + event->name;
+        if (event->mask & IN_ISDIR) {
+          if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch(path);
+          }
+          continue;
+        }
+        changes.push_back(path);
+      }
+    }
+  }
+
+  void Daemon::serve_client(const RequestHandler& handle_request) {
+    int client_fd = accept4(socket_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client_fd == -1) {
+      return;
+    }
+    // Don't let a silent client hold up the daemon.
+    timeval timeout = {};
+    timeout.tv_sec = 1;
+    setsockopt(
+      client_fd,
+      SOL_SOCKET,
+      SO_RCVTIMEO,
+      &timeout,
+      sizeof(timeout)
+    );
+    std::string request;
+    char c;
+    while (request.size() < 4096 && read(client_fd, &c, 1) == 1
+           && c != '\n') {
+      request += c;
+    }
+    auto response = handle_request(request) + "\n";
+    send(client_fd, response.data(), response.size(), MSG_NOSIGNAL);
+    close(client_fd);
+  }
+
+}
@@ -1,13 +1,17 @@
 /**
  * Compiles a tileset into an ULTRA240 binary.
  */
-#include <fstream>
 #include <iostream>
+#include <optional>
+#include <ultra240-sdk/sections.h>
 #include <ultra240-sdk/tileset.h>
 #include <stdexcept>
+#include <vector>
 
 static void print_usage(const char* self, std::ostream& out) {
-  out << "Usage: " << self << " [-h] <in.tsx> <out.bin>" << std::endl;
+  out << "Usage: " << self
+      << " [-h] [-l] [-p] [-s] [-t] [-H names.h] <in.tsx> <out.bin>"
+      << std::endl;
 }
 
 int main(int argc, const char* argv[]) {
@@ -19,155 +23,158 @@ int main(int argc, const char* argv[]) {
       return 0;
     }
   }
-  if (argc != 3) {
+  // Check for name header, lookup table, string pool, shared data and
+  // section table options.
+  const char* header_path = nullptr;
+  bool lookup = false;
+  bool pool_strings = false;
+  bool shared = false;
+  bool section_table = false;
+  std::vector<const char*> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-H" && i + 1 < argc) {
+      header_path = argv[++i];
+    } else if (arg == "-l") {
+      lookup = true;
+    } else if (arg == "-p") {
+      pool_strings = true;
+    } else if (arg == "-s") {
+      shared = true;
+    } else if (arg == "-t") {
+      section_table = true;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      print_usage(argv[0], std::cerr);
+      return 1;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  if (args.size() != 2) {
     print_usage(argv[0], std::cerr);
     return 1;
   }
-  std::string path(argv[1]);
+  std::string path(args[0]);
   auto prefix = path.substr(0, path.rfind("/"));
   if (prefix == path) {
     prefix = ".";
   }
   prefix += "/";
-  auto tileset = ultra::sdk::read_tileset(argv[1]);
-  // Get size of serialized tileset.
-  size_t buf_size = 0;
-  size_t size;
-  ultra::sdk::write_tileset(
-    tileset,
-    nullptr,
-    &size,
-    nullptr,
-    nullptr,
-    nullptr
-  );
-  buf_size += size;
-  buf_size += tileset.source.size() + 1;
-  for (const auto& pair : tileset.tiles) {
-    ultra::sdk::write_tileset_tile(
-      pair.first,
-      pair.second,
-      nullptr,
-      &size,
-      nullptr,
-      nullptr
-    );
-    buf_size += size;
-    buf_size += pair.second.library.size() + 1;
+  auto tileset = ultra::sdk::read_tileset(args[0]);
+  if (header_path != nullptr) {
+    ultra::sdk::util::write_names_header(tileset.names, header_path);
   }
-  for (const auto& pair : tileset.tiles) {
-    for (const auto& pair : pair.second.collision_boxes) {
-      write_tileset_tile_collision_box_type(
-        pair.first,
-        pair.second,
-        nullptr,
-        &size,
-        nullptr
-      );
-      buf_size += size;
+  // Serialize tileset.
+  ultra::sdk::Writer writer(args[1]);
+  std::optional<ultra::sdk::SectionTable> sections;
+  if (section_table) {
+    auto flags = ultra::sdk::SectionFlags::None;
+    if (lookup) {
+      flags |= ultra::sdk::SectionFlags::TileLookup;
     }
-  }
-  for (const auto& pair : tileset.tiles) {
-    for (const auto& pair : pair.second.collision_boxes) {
-      for (const auto& pair : pair.second) {
-        write_tileset_tile_collision_box_list(
-          pair.first,
-          pair.second,
-          nullptr,
-          &size
-        );
-        buf_size += size;
-      }
+    if (shared) {
+      flags |= ultra::sdk::SectionFlags::SharedTileData;
     }
+    if (pool_strings) {
+      flags |= ultra::sdk::SectionFlags::PooledStrings;
+    }
+    sections.emplace(1 + pool_strings, writer);
+    sections->begin(ultra::sdk::SectionType::Tilesets, flags);
   }
-  buf_size += tileset.library.size() + 1;
-  for (const auto& pair : tileset.tiles) {
-    buf_size += pair.second.library.size() + 1;
-  }
-  // Write serialized tileset.
-  uint8_t buf[buf_size];
-  uint8_t* p = buf;
-  uint32_t* source_offset_entry;
-  std::list<uint32_t*> tile_offset_entries;
-  uint32_t* library_offset_entry;
-  ultra::sdk::write_tileset(
-    tileset,
-    p,
-    &size,
-    &source_offset_entry,
-    &tile_offset_entries,
-    &library_offset_entry
-  );
-  p += size;
-  *source_offset_entry = static_cast<uint32_t>(p - buf);
-  std::copy(tileset.source.begin(), tileset.source.end(), p);
-  p[tileset.source.size()] = '\0';
-  p += tileset.source.size() + 1;
-  std::list<uint32_t*> collision_box_type_offset_entries;
-  std::list<uint32_t*> tile_library_offset_entries;
+  auto patches = ultra::sdk::write_tileset(tileset, writer, lookup);
+  // Pooled strings are written last.
+  ultra::sdk::StringPool strings;
+  auto write_string = [&](
+    const ultra::sdk::Writer::Patch<uint32_t>& offset,
+    const std::string& string
+  ) {
+    if (pool_strings) {
+      strings.add(offset.position(), string);
+    } else {
+      offset.set(writer.offset());
+      writer.write_string(string);
+    }
+  };
+  write_string(patches.source, tileset.source);
+  std::vector<ultra::sdk::TilesetTilePatches> tile_patches;
+  tile_patches.reserve(tileset.tiles.size());
+  size_t i = 0;
   for (const auto& pair : tileset.tiles) {
-    *tile_offset_entries.front() = static_cast<uint32_t>(p - buf);
-    tile_offset_entries.pop_front();
-    uint32_t* library_offset_entry;
-    ultra::sdk::write_tileset_tile(
-      pair.first,
-      pair.second,
-      p,
-      &size,
-      &collision_box_type_offset_entries,
-      &library_offset_entry
+    patches.tiles[i++].set(writer.offset());
+    if (lookup) {
+      patches.lookup[pair.first].set(writer.offset());
+    }
+    tile_patches.push_back(
+      ultra::sdk::write_tileset_tile(pair.first, pair.second, writer, shared)
     );
-    tile_library_offset_entries.push_back(library_offset_entry);
-    p += size;
   }
-  std::list<uint32_t*> collision_box_list_offset_entries;
+  std::vector<ultra::sdk::Writer::Patch<uint32_t>> collision_box_list_patches;
+  i = 0;
   for (const auto& pair : tileset.tiles) {
+    size_t j = 0;
     for (const auto& pair : pair.second.collision_boxes) {
-      *collision_box_type_offset_entries.front() =
-        static_cast<uint32_t>(p - buf);
-      collision_box_type_offset_entries.pop_front();
-      write_tileset_tile_collision_box_type(
-        pair.first,
-        pair.second,
-        p,
-        &size,
-        &collision_box_list_offset_entries
+      tile_patches[i].collision_box_types[j++].set(writer.offset());
+      collision_box_list_patches.push_back(
+        write_tileset_tile_collision_box_type(pair.first, pair.second, writer)
       );
-      p += size;
     }
+    i++;
   }
+  // Write identical collision box lists and animations once if sharing.
+  ultra::sdk::TileDataPool pool;
+  i = 0;
   for (const auto& pair : tileset.tiles) {
     for (const auto& pair : pair.second.collision_boxes) {
+      size_t j = 0;
       for (const auto& pair : pair.second) {
-        *collision_box_list_offset_entries.front() =
-          static_cast<uint32_t>(p - buf);
-        collision_box_list_offset_entries.pop_front();
-        write_tileset_tile_collision_box_list(
-          pair.first,
-          pair.second,
-          p,
-          &size
+        if (shared) {
+          collision_box_list_patches[i][j++].set(
+            write_shared_collision_box_list(
+              pair.first,
+              pair.second,
+              pool,
+              writer
+            )
+          );
+        } else {
+          collision_box_list_patches[i][j++].set(writer.offset());
+          write_tileset_tile_collision_box_list(
+            pair.first,
+            pair.second,
+            writer
+          );
+        }
+      }
+      i++;
+    }
+  }
+  if (shared) {
+    i = 0;
+    for (const auto& pair : tileset.tiles) {
+      const auto& animation_tiles = pair.second.animation_tiles;
+      if (!animation_tiles.empty()) {
+        tile_patches[i].animation.set(
+          write_shared_animation(animation_tiles, pool, writer)
         );
-        p += size;
       }
+      i++;
     }
   }
-  *library_offset_entry = static_cast<uint32_t>(p - buf);
-  std::copy(tileset.library.begin(), tileset.library.end(), p);
-  p[tileset.library.size()] = '\0';
-  p += tileset.library.size() + 1;
+  write_string(patches.library, tileset.library);
+  i = 0;
   for (const auto& pair : tileset.tiles) {
-    *tile_library_offset_entries.front() = static_cast<uint32_t>(p - buf);
-    tile_library_offset_entries.pop_front();
-    std::copy(pair.second.library.begin(), pair.second.library.end(), p);
-    p[pair.second.library.size()] = '\0';
-    p += pair.second.library.size() + 1;
+    write_string(tile_patches[i++].library, pair.second.library);
   }
-  // Write the binary format.
-  std::ofstream out(argv[2]);
-  if (!out.is_open()) {
-    throw std::runtime_error("Could not open output file");
+  if (pool_strings) {
+    if (sections) {
+      sections->begin(ultra::sdk::SectionType::Strings);
+    }
+    strings.write(writer);
+  }
+  if (sections) {
+    sections->end();
   }
-  out.write(reinterpret_cast<char*>(buf), sizeof(buf));
+  // Write the binary format.
+  writer.flush();
   return 0;
 }
@@ -1,6 +1,11 @@
 /** Compile a world file into an ULTRA240 binary. */
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <json/json.h>
@@ -8,13 +13,23 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <optional>
+#include <queue>
+#include <ultra240-sdk/boundary.h>
+#include <ultra240-sdk/bounds.h>
+#include <ultra240-sdk/bvh.h>
+#include <ultra240-sdk/codec.h>
+#include <ultra240-sdk/daemon.h>
+#include <ultra240-sdk/sections.h>
 #include <ultra240-sdk/tileset.h>
 #include <ultra240-sdk/util.h>
-#include <queue>
+#include <ultra240-sdk/writer.h>
 #include <rapidxml/rapidxml.hpp>
 #include <rapidxml/rapidxml_utils.hpp>
+#include <set>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <yaml-cpp/yaml.h>
@@ -26,11 +41,20 @@ struct Tileset {
   ssize_t map_index;
   ssize_t entity_index;
   uint16_t first_gid;
-  ultra::sdk::Tileset tileset;
+  // The file the tileset was read from.
+  std::string path;
+  std::shared_ptr<const ultra::sdk::Tileset> tileset;
 };
 
+// Tile ids used by a map, by tileset source.
+typedef std::map<std::string, std::set<uint16_t>> TileUsage;
+
 typedef std::tuple<uint8_t, uint8_t> fraction_t;
 
+using ultra::sdk::Boundary;
+using ultra::sdk::InlineArray;
+using ultra::sdk::Point;
+
 struct Layer {
   uint32_t name;
   enum Type {
@@ -61,18 +85,100 @@ struct Map {
   std::vector<Tileset> entity_tilesets;
   std::vector<Layer> layers;
   std::vector<Entity> entities;
+  ultra::sdk::util::HashMap<std::string> names;
+  // Tiles the map's layers and entities show. Maps loaded from the cache
+  // keep this instead of their layers and entities.
+  TileUsage tile_usage;
+  // Cache key of the map's inputs, and whether the map was loaded from the
+  // cache directory instead of parsed.
+  std::string key;
+  bool cached;
 };
 
-struct Point {
-  int32_t x;
-  int32_t y;
+// The position and type of an indexed entity's id within a serialized map.
+struct IndexedEntity {
+  uint32_t id_offset;
+  uint16_t type;
 };
 
-template<template<typename> typename T>
-class Boundary : public T<Point> {
-public:
-  Boundary() : flags(0) {}
-  uint8_t flags;
+// The position of a shared tileset's index within a serialized map, the
+// key of the tileset and the file it was read from.
+struct TilesetRef {
+  uint32_t index_offset;
+  std::string key;
+  std::string path;
+};
+
+// The position of an offset to a string in the world's string pool within
+// a serialized map or tileset.
+struct StringRef {
+  uint32_t offset;
+  std::string string;
+};
+
+// A map or tileset serialized at offset zero. Offsets are rebased, and
+// indexed entity ids, shared tileset indexes and pooled strings assigned,
+// when it is written into the world.
+struct Blob {
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> relocations;
+  std::vector<IndexedEntity> indexed_entities;
+  std::vector<TilesetRef> tileset_refs;
+  std::vector<StringRef> string_refs;
+};
+
+// Optional parts of the tileset format.
+struct TilesetFormat {
+  // Whether to end tileset headers with a table of tiles by id.
+  bool lookup;
+  // Whether to write identical collision box lists and animations once.
+  bool share_data;
+  // Whether to write strings into the world's string pool.
+  bool pool_strings;
+};
+
+// A map kept in memory between builds by the daemon.
+struct ResidentMap {
+  Map map;
+  std::vector<Layer> bounds;
+  std::shared_ptr<const Blob> blob;
+};
+
+// Tilesets written once for the whole world, by the key of their serialized
+// form.
+struct TilesetTable {
+  std::unordered_map<
+    std::shared_ptr<const ultra::sdk::Tileset>,
+    std::string
+  > keys;
+  std::unordered_map<std::string, std::shared_ptr<const Blob>> blobs;
+};
+
+// Maps built by earlier runs, reused while their inputs are unchanged.
+struct MapCache {
+  // Directory of map and tileset artifacts, or empty.
+  std::string dir;
+  // Whether to keep maps and boundaries in memory for the next build.
+  bool resident;
+  std::unordered_map<std::string, ResidentMap> maps;
+  TilesetTable tilesets;
+  uint64_t bounds_key;
+  std::list<Boundary<std::list>> boundaries;
+  // Map and tileset files read by the last build.
+  std::set<std::string> inputs;
+};
+
+// The collision class of every tile of a map, packed bits to a tile.
+struct CollisionGrid {
+  uint8_t bits;
+  std::vector<uint8_t> data;
+};
+
+// Floor and ceiling heights of every tile shape, and the index of each
+// map's tiles in them.
+struct HeightTables {
+  std::vector<uint8_t> table;
+  std::vector<std::vector<uint8_t>> maps;
 };
 
 static long gcd(long a, long b) {
@@ -120,38 +226,118 @@ static rapidxml::file<> load_xml(
   return file;
 }
 
-static void write_layer(
+enum LayerEncoding {
+  Dense   = 0x00,
+  Sparse  = 0x01,
+};
+
+static void write_layer_header(
+  const Layer& layer,
+  ultra::sdk::Writer& writer
+) {
+  writer.write<uint32_t>(layer.name);
+  writer.write<uint8_t>(std::get<0>(layer.parallax.x));
+  writer.write<uint8_t>(std::get<1>(layer.parallax.x));
+  writer.write<uint8_t>(std::get<0>(layer.parallax.y));
+  writer.write<uint8_t>(std::get<1>(layer.parallax.y));
+}
+
+// Write only a layer's non-empty tiles, as runs within each row. A row-major
+// table holds the offset of each row, which starts with its run count. Each
+// run is its x position, its length and its tiles.
+static void write_layer_spans(
+  const Layer& layer,
+  uint16_t w,
+  uint16_t h,
+  ultra::sdk::Writer& writer
+) {
+  auto row_offsets = writer.reserve<uint32_t>(h);
+  for (uint32_t y = 0; y < h; y++) {
+    row_offsets[y].set_offset(writer.offset());
+    auto span_count = writer.reserve<uint16_t>();
+    uint16_t spans = 0;
+    const uint16_t* row = &layer.tiles[y * w];
+    for (uint32_t x = 0; x < w; ) {
+      if (!row[x]) {
+        x++;
+        continue;
+      }
+      uint32_t end = x;
+      while (end < w && row[end]) {
+        end++;
+      }
+      writer.write<uint16_t>(x);
+      writer.write<uint16_t>(end - x);
+      writer.write_bytes(row + x, (end - x) * sizeof(uint16_t));
+      spans++;
+      x = end;
+    }
+    span_count.set(spans);
+  }
+}
+
+// Interleave the bits of x and y.
+static uint32_t morton(uint16_t x, uint16_t y) {
+  uint32_t code = 0;
+  for (int bit = 0; bit < 16; bit++) {
+    code |= ((x >> bit) & 1u) << (bit * 2);
+    code |= ((y >> bit) & 1u) << (bit * 2 + 1);
+  }
+  return code;
+}
+
+// Write a layer's tiles in square blocks, so that drawing a viewport reads a
+// few contiguous blocks rather than a run from every row of the map. Blocks
+// are stored in row-major order, or in Morton order to keep neighbouring
+// blocks close, and found through a row-major table of block offsets. Blocks
+// at the right and bottom edges are padded with empty tiles. Compressed
+// blocks can each be decoded on their own.
+static void write_layer_blocks(
   const Layer& layer,
   uint16_t w,
   uint16_t h,
-  uint8_t* buf,
-  size_t* buf_size
+  uint16_t size,
+  bool morton_order,
+  bool compress,
+  ultra::sdk::Writer& writer
 ) {
-  uint8_t* p = buf;
-  uint32_t* name = reinterpret_cast<uint32_t*>(p);
-  p += sizeof(uint32_t);
-  uint8_t* pxn = p;
-  p += sizeof(uint8_t);
-  uint8_t* pxd = p;
-  p += sizeof(uint8_t);
-  uint8_t* pyn = p;
-  p += sizeof(uint8_t);
-  uint8_t* pyd = p;
-  p += sizeof(uint8_t);
-  uint16_t* tiles = reinterpret_cast<uint16_t*>(p);
-  p += w * h * sizeof(uint16_t);
-  if (buf != nullptr) {
-    *name = layer.name;
-    *pxn = std::get<0>(layer.parallax.x);
-    *pxd = std::get<1>(layer.parallax.x);
-    *pyn = std::get<0>(layer.parallax.y);
-    *pyd = std::get<1>(layer.parallax.y);
-    for (const auto& tile : layer.tiles) {
-      *tiles++ = tile;
-    }
-  }
-  if (buf_size != nullptr) {
-    *buf_size = p - buf;
+  if (!size) {
+    throw std::runtime_error("Layer blocks must not be empty");
+  }
+  uint16_t cols = (w + size - 1) / size;
+  uint16_t rows = (h + size - 1) / size;
+  writer.write<uint16_t>(size);
+  writer.write<uint16_t>(cols);
+  writer.write<uint16_t>(rows);
+  auto block_offsets = writer.reserve<uint32_t>(cols * rows);
+  std::vector<uint32_t> order(cols * rows);
+  for (uint32_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  if (morton_order) {
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return morton(a % cols, a / cols) < morton(b % cols, b / cols);
+    });
+  }
+  std::vector<uint16_t> block(size * size);
+  for (auto i : order) {
+    uint32_t block_x = (i % cols) * size;
+    uint32_t block_y = (i / cols) * size;
+    for (uint32_t y = 0; y < size; y++) {
+      for (uint32_t x = 0; x < size; x++) {
+        bool inside = block_x + x < w && block_y + y < h;
+        block[x + y * size] = inside
+          ? layer.tiles[block_x + x + (block_y + y) * w]
+          : 0;
+      }
+    }
+    block_offsets[i].set_offset(writer.offset());
+    if (compress) {
+      auto data = ultra::sdk::compress_tiles(block.data(), block.size());
+      writer.write_bytes(data.data(), data.size());
+    } else {
+      writer.write_bytes(block.data(), block.size() * sizeof(uint16_t));
+    }
   }
 }
 
@@ -188,124 +374,377 @@ static bool is_indexed_entity(const Entity& entity, YAML::Node& config) {
 static void write_entity(
   const Entity& entity,
   YAML::Node& config,
-  std::unordered_map<uint16_t, uint16_t>& type_ids,
-  uint8_t* buf,
-  size_t* buf_size
+  std::vector<IndexedEntity>& indexed_entities,
+  ultra::sdk::Writer& writer
 ) {
-  uint8_t* p = buf;
-  uint32_t* layer_name = reinterpret_cast<uint32_t*>(p);
-  p += sizeof(uint32_t);
-  uint16_t* x = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint16_t* y = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint16_t* tile = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint16_t* type = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint16_t* id = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint32_t* state = reinterpret_cast<uint32_t*>(p);
-  p += sizeof(uint32_t);
-  if (buf != nullptr) {
-    *layer_name = entity.layer_name;
-    *x = entity.x;
-    *y = entity.y;
-    *tile = entity.tile;
-    *type = get_entity_type(entity, config);
-    if (is_indexed_entity(entity, config)) {
-      type_ids.emplace(*type, 1);
-      *id = type_ids[*type]++;
-    } else {
-      *id = 0;
+  uint16_t type = get_entity_type(entity, config);
+  writer.write<uint32_t>(entity.layer_name);
+  writer.write<uint16_t>(entity.x);
+  writer.write<uint16_t>(entity.y);
+  writer.write<uint16_t>(entity.tile);
+  writer.write<uint16_t>(type);
+  // Ids are numbered across the world when the map is written.
+  if (is_indexed_entity(entity, config)) {
+    indexed_entities.push_back({writer.offset(), type});
+  }
+  writer.write<uint16_t>(0);
+  writer.write<uint32_t>(entity.state);
+}
+
+// Write a string and point offset to it, or with a string pool, leave the
+// offset to be set when the pool is written.
+static void write_string(
+  const ultra::sdk::Writer::Patch<uint32_t>& offset,
+  const std::string& string,
+  const TilesetFormat& format,
+  Blob& blob,
+  ultra::sdk::Writer& writer
+) {
+  if (format.pool_strings) {
+    blob.string_refs.push_back({
+      static_cast<uint32_t>(offset.position()),
+      string,
+    });
+  } else {
+    offset.set_offset(writer.offset());
+    writer.write_string(string);
+  }
+}
+
+static void write_tileset_tiles(
+  const ultra::sdk::Tileset& tileset,
+  const ultra::sdk::TilesetPatches& tileset_patches,
+  const TilesetFormat& format,
+  Blob& blob,
+  ultra::sdk::Writer& writer
+) {
+  ultra::sdk::TileDataPool pool;
+  size_t i = 0;
+  for (const auto& pair : tileset.tiles) {
+    // Tile.
+    tileset_patches.tiles[i++].set_offset(writer.offset());
+    if (format.lookup) {
+      tileset_patches.lookup[pair.first].set_offset(writer.offset());
+    }
+    auto patches = ultra::sdk::write_tileset_tile(
+      pair.first,
+      pair.second,
+      writer,
+      format.share_data
+    );
+    // Tile animation.
+    if (format.share_data && !pair.second.animation_tiles.empty()) {
+      patches.animation.set_offset(
+        write_shared_animation(pair.second.animation_tiles, pool, writer)
+      );
+    }
+    // Tile library.
+    write_string(patches.library, pair.second.library, format, blob, writer);
+    size_t j = 0;
+    for (const auto& pair : pair.second.collision_boxes) {
+      // Tile collision box type.
+      patches.collision_box_types[j++].set_offset(writer.offset());
+      auto list_offsets = write_tileset_tile_collision_box_type(
+        pair.first,
+        pair.second,
+        writer
+      );
+      size_t k = 0;
+      for (const auto& pair : pair.second) {
+        // Tile collision boxes.
+        if (format.share_data) {
+          list_offsets[k++].set_offset(
+            write_shared_collision_box_list(
+              pair.first,
+              pair.second,
+              pool,
+              writer
+            )
+          );
+        } else {
+          list_offsets[k++].set_offset(writer.offset());
+          write_tileset_tile_collision_box_list(
+            pair.first,
+            pair.second,
+            writer
+          );
+        }
+      }
+    }
+  }
+}
+
+// FNV-1a.
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+  auto bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// Hash a length-prefixed field.
+static uint64_t hash_field(uint64_t hash, const std::string& field) {
+  uint64_t size = field.size();
+  hash = hash_bytes(hash, &size, sizeof(size));
+  return hash_bytes(hash, field.data(), field.size());
+}
+
+static void write_full_tileset(
+  const ultra::sdk::Tileset& tileset,
+  const TilesetFormat& format,
+  Blob& blob,
+  ultra::sdk::Writer& writer
+) {
+  auto patches = ultra::sdk::write_tileset(tileset, writer, format.lookup);
+  // Tileset source.
+  write_string(patches.source, tileset.source, format, blob, writer);
+  // Tiles.
+  write_tileset_tiles(tileset, patches, format, blob, writer);
+  // Tileset library.
+  write_string(patches.library, tileset.library, format, blob, writer);
+}
+
+static Blob serialize_tileset(
+  const ultra::sdk::Tileset& tileset,
+  const TilesetFormat& format
+) {
+  Blob blob;
+  ultra::sdk::Writer writer;
+  write_full_tileset(tileset, format, blob, writer);
+  blob.data.assign(writer.data(), writer.data() + writer.size());
+  blob.relocations = writer.relocations();
+  return blob;
+}
+
+// Add a tileset to the world's table, returning its key.
+static std::string share_tileset(
+  const std::shared_ptr<const ultra::sdk::Tileset>& tileset,
+  const TilesetFormat& format,
+  TilesetTable& tilesets
+) {
+  auto key = tilesets.keys.find(tileset);
+  if (key != tilesets.keys.end()) {
+    return key->second;
+  }
+  auto blob = std::make_shared<Blob>(serialize_tileset(*tileset, format));
+  // Key the tileset by its serialized form, which is all the world uses.
+  uint64_t hash = 0xcbf29ce484222325;
+  hash = hash_bytes(hash, blob->data.data(), blob->data.size());
+  hash = hash_bytes(
+    hash,
+    blob->relocations.data(),
+    blob->relocations.size() * sizeof(uint32_t)
+  );
+  for (const auto& ref : blob->string_refs) {
+    hash = hash_bytes(hash, &ref.offset, sizeof(ref.offset));
+    hash = hash_field(hash, ref.string);
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+  tilesets.keys[tileset] = hex;
+  tilesets.blobs.emplace(hex, blob);
+  return hex;
+}
+
+static TileUsage get_tile_usage(const Map& map) {
+  TileUsage usage;
+  auto use = [&](const Tileset& tileset, uint16_t tile_id) {
+    usage[tileset.tileset->source].insert(tile_id);
+  };
+  for (const auto& layer : map.layers) {
+    if (layer.type != Layer::Type::Bounds) {
+      for (auto tile : layer.tiles) {
+        if (tile) {
+          use(map.map_tilesets[tile >> 12], (tile & 0xfff) - 1);
+        }
+      }
+    }
+  }
+  for (const auto& entity : map.entities) {
+    if (entity.tile) {
+      use(map.entity_tilesets[entity.tile >> 12], (entity.tile & 0x3ff) - 1);
+    }
+  }
+  return usage;
+}
+
+// Copy a tileset with only the tiles in usage, and the tiles their
+// animations show.
+static std::shared_ptr<const ultra::sdk::Tileset> strip_tileset(
+  const ultra::sdk::Tileset& tileset,
+  const TileUsage& usage
+) {
+  std::vector<bool> used(0x10000);
+  auto tiles = usage.find(tileset.source);
+  if (tiles != usage.end()) {
+    for (auto tile_id : tiles->second) {
+      used[tile_id] = true;
+    }
+  }
+  std::vector<uint16_t> pending;
+  for (const auto& pair : tileset.tiles) {
+    if (used[pair.first]) {
+      pending.push_back(pair.first);
+    }
+  }
+  while (!pending.empty()) {
+    auto tile = tileset.tiles.find(pending.back());
+    pending.pop_back();
+    if (tile == tileset.tiles.end()) {
+      continue;
+    }
+    for (const auto& animation_tile : tile->second.animation_tiles) {
+      if (!used[animation_tile.tile_id]) {
+        used[animation_tile.tile_id] = true;
+        pending.push_back(animation_tile.tile_id);
+      }
+    }
+  }
+  auto stripped = std::make_shared<ultra::sdk::Tileset>();
+  stripped->tile_count = tileset.tile_count;
+  stripped->tile_w = tileset.tile_w;
+  stripped->tile_h = tileset.tile_h;
+  stripped->margin = tileset.margin;
+  stripped->spacing = tileset.spacing;
+  stripped->columns = tileset.columns;
+  stripped->source = tileset.source;
+  stripped->library = tileset.library;
+  stripped->bounds = tileset.bounds;
+  for (const auto& pair : tileset.tiles) {
+    if (used[pair.first]) {
+      stripped->tiles.insert(pair);
+    }
+  }
+  return stripped;
+}
+
+// Bucket entities into a grid of cells, so that a runtime can find the
+// entities near the camera by visiting the cells it overlaps. Cells list the
+// indexes of the entities overlapping them in ascending order.
+static void write_entity_grid(
+  const Map& map,
+  uint16_t cell_w,
+  uint16_t cell_h,
+  ultra::sdk::Writer& writer
+) {
+  if (!cell_w || !cell_h) {
+    throw std::runtime_error("Entity grid cells must not be empty");
+  }
+  int cols = std::max(1, (map.w * 16 + cell_w - 1) / cell_w);
+  int rows = std::max(1, (map.h * 16 + cell_h - 1) / cell_h);
+  std::vector<std::vector<uint16_t>> cells(cols * rows);
+  for (int i = 0; i < map.entities.size(); i++) {
+    const auto& entity = map.entities[i];
+    // Clamp entities outside the map to the edge cells.
+    int col_min = std::clamp(entity.x / cell_w, 0, cols - 1);
+    int col_max = std::clamp(
+      (entity.x + std::max<int>(entity.w, 1) - 1) / cell_w,
+      0,
+      cols - 1
+    );
+    int row_min = std::clamp(entity.y / cell_h, 0, rows - 1);
+    int row_max = std::clamp(
+      (entity.y + std::max<int>(entity.h, 1) - 1) / cell_h,
+      0,
+      rows - 1
+    );
+    for (int row = row_min; row <= row_max; row++) {
+      for (int col = col_min; col <= col_max; col++) {
+        cells[col + row * cols].push_back(i);
+      }
     }
-    *state = entity.state;
   }
-  if (buf_size != nullptr) {
-    *buf_size = p - buf;
+  writer.write<uint16_t>(cell_w);
+  writer.write<uint16_t>(cell_h);
+  writer.write<uint16_t>(cols);
+  writer.write<uint16_t>(rows);
+  // Start of each cell's indexes, followed by the end of the last cell.
+  uint32_t start = 0;
+  for (const auto& cell : cells) {
+    writer.write<uint32_t>(start);
+    start += cell.size();
+  }
+  writer.write<uint32_t>(start);
+  // Entity indexes.
+  for (const auto& cell : cells) {
+    writer.write_bytes(cell.data(), cell.size() * sizeof(uint16_t));
+  }
+}
+
+// Reserve offsets for a map's tilesets, or with a tileset table, write
+// indexes into it to be assigned when the world is written.
+static ultra::sdk::Writer::Patch<uint32_t> write_tileset_refs(
+  const std::vector<Tileset>& list,
+  const TilesetFormat& format,
+  TilesetTable* tilesets,
+  Blob& blob,
+  ultra::sdk::Writer& writer
+) {
+  if (tilesets == nullptr) {
+    return writer.reserve<uint32_t>(list.size());
+  }
+  for (const auto& tileset : list) {
+    blob.tileset_refs.push_back({
+      writer.offset(),
+      share_tileset(tileset.tileset, format, *tilesets),
+      tileset.path,
+    });
+    writer.write<uint16_t>(0);
   }
+  return writer.reserve<uint32_t>(0);
 }
 
+// Write a map. With a tileset table, tilesets are added to it and the map
+// refers to them by index instead of embedding them.
 static void write_map(
   const Map& map,
   YAML::Node& config,
-  std::unordered_map<uint16_t, uint16_t>& type_ids,
-  uint32_t offset,
-  uint8_t* buf,
-  size_t* buf_size
+  TilesetTable* tilesets,
+  Blob& blob,
+  ultra::sdk::Writer& writer
 ) {
-  std::list<uint32_t> map_tileset_offsets;
-  std::list<uint32_t*> map_tileset_source_offset_entries;
-  std::list<uint32_t*> map_tileset_tile_offset_entries;
-  std::list<uint32_t*> map_tileset_library_offset_entries;
-  std::list<uint8_t*> map_tileset_sources;
-  std::list<uint8_t*> map_tileset_tiles;
-  std::list<uint8_t*> map_tileset_tile_collision_box_types;
-  std::list<uint8_t*> map_tileset_tile_collision_box_lists;
-  std::list<uint8_t*> map_tileset_libraries;
-  std::list<uint8_t*> map_tileset_tile_libraries;
-  std::list<uint32_t> entity_tileset_offsets;
-  std::list<uint32_t*> entity_tileset_source_offset_entries;
-  std::list<uint32_t*> entity_tileset_tile_offset_entries;
-  std::list<uint32_t*> entity_tileset_library_offset_entries;
-  std::list<uint8_t*> entity_tileset_sources;
-  std::list<uint8_t*> entity_tileset_tiles;
-  std::list<uint8_t*> entity_tileset_tile_collision_box_types;
-  std::list<uint8_t*> entity_tileset_tile_collision_box_lists;
-  std::list<uint8_t*> entity_tileset_libraries;
-  std::list<uint8_t*> entity_tileset_tile_libraries;
-  uint8_t* p = buf;
+  TilesetFormat format = {
+    .lookup = config["tile_lookup"].as<bool>(false),
+    .share_data = config["share_tile_data"].as<bool>(false),
+    .pool_strings = config["string_pool"].as<bool>(false),
+  };
   // Position.
-  int16_t* x = reinterpret_cast<int16_t*>(p);
-  p += sizeof(uint16_t);
-  int16_t* y = reinterpret_cast<int16_t*>(p);
-  p += sizeof(uint16_t);
+  writer.write<int16_t>(map.x);
+  writer.write<int16_t>(map.y);
   // Dimensions.
-  uint16_t* w = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  uint16_t* h = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
+  writer.write<uint16_t>(map.w);
+  writer.write<uint16_t>(map.h);
   // Properties.
-  uint8_t* properties_count = p;
-  p += sizeof(uint8_t);
-  std::vector<uint32_t*> properties(map.properties.size());
-  for (int i = 0; i < map.properties.size(); i++) {
-    properties[i] = reinterpret_cast<uint32_t*>(p);
-    p += sizeof(uint32_t);
-  }
-  // Map tileset count.
-  uint8_t* MTSn = p;
-  p += sizeof(uint8_t);
-  // Map tileset offsets.
-  std::list<uint32_t*> map_tileset_offset_entries;
-  for (int i = 0; i < map.map_tilesets.size(); i++) {
-    map_tileset_offset_entries.push_back(reinterpret_cast<uint32_t*>(p));
-    p += sizeof(uint32_t);
+  writer.write<uint8_t>(map.properties.size() / 2);
+  for (auto property : map.properties) {
+    writer.write<uint32_t>(property);
   }
-  // Entity tileset count.
-  uint8_t* ETSn = p;
-  p += sizeof(uint8_t);
+  // Map tileset offsets.
+  writer.write<uint8_t>(map.map_tilesets.size());
+  auto map_tileset_offsets = write_tileset_refs(
+    map.map_tilesets,
+    format,
+    tilesets,
+    blob,
+    writer
+  );
   // Entity tileset offsets.
-  std::list<uint32_t*> entity_tileset_offset_entries;
-  for (int i = 0; i < map.entity_tilesets.size(); i++) {
-    entity_tileset_offset_entries.push_back(reinterpret_cast<uint32_t*>(p));
-    p += sizeof(uint32_t);
-  }
+  writer.write<uint8_t>(map.entity_tilesets.size());
+  auto entity_tileset_offsets = write_tileset_refs(
+    map.entity_tilesets,
+    format,
+    tilesets,
+    blob,
+    writer
+  );
   // Layer offsets.
-  uint8_t* Ln = p;
-  p += sizeof(uint8_t);
-  std::queue<uint32_t*> layer_offset_entries;
-  for (int i = 0; i < map.layers.size(); i++) {
-    layer_offset_entries.push(reinterpret_cast<uint32_t*>(p));
-    p += sizeof(uint32_t);
-  }
-  // Entity offsets.
-  uint16_t* En = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
+  writer.write<uint8_t>(map.layers.size());
+  auto layer_offsets = writer.reserve<uint32_t>(map.layers.size());
+  // Entities.
+  writer.write<uint16_t>(map.entities.size());
   for (const auto& entity : map.entities) {
-    size_t entity_size;
-    write_entity(entity, config, type_ids, buf ? p : nullptr, &entity_size);
-    p += entity_size;
+    write_entity(entity, config, blob.indexed_entities, writer);
   }
   // Sort entities by x and y.
   std::vector<uint16_t>
@@ -347,600 +786,879 @@ static void write_map(
     y_sorted_max.begin(),
     y_sorted_max.end(),
     [&](uint16_t a, uint16_t b) {
-      auto a_max = map.entities[a].y + map.entities[a].y;
-      auto b_max = map.entities[b].y + map.entities[b].y;
+      auto a_max = map.entities[a].y + map.entities[a].h;
+      auto b_max = map.entities[b].y + map.entities[b].h;
       return a_max < b_max;
     }
   );
   // Sorted entity indexes.
-  std::vector<uint16_t*> x_sorted_min_ptrs(map.entities.size());
-  for (int i = 0; i < map.entities.size(); i++) {
-    x_sorted_min_ptrs[i] = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-  }
-  std::vector<uint16_t*> x_sorted_max_ptrs(map.entities.size());
-  for (int i = 0; i < map.entities.size(); i++) {
-    x_sorted_max_ptrs[i] = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-  }
-  std::vector<uint16_t*> y_sorted_min_ptrs(map.entities.size());
-  for (int i = 0; i < map.entities.size(); i++) {
-    y_sorted_min_ptrs[i] = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-  }
-  std::vector<uint16_t*> y_sorted_max_ptrs(map.entities.size());
-  for (int i = 0; i < map.entities.size(); i++) {
-    y_sorted_max_ptrs[i] = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
+  size_t indexes_size = map.entities.size() * sizeof(uint16_t);
+  writer.write_bytes(x_sorted_min.data(), indexes_size);
+  writer.write_bytes(x_sorted_max.data(), indexes_size);
+  writer.write_bytes(y_sorted_min.data(), indexes_size);
+  writer.write_bytes(y_sorted_max.data(), indexes_size);
+  // Entity grid.
+  if (config["entity_grid"].IsDefined()) {
+    write_entity_grid(
+      map,
+      config["entity_grid"]["cell_w"].as<uint16_t>(),
+      config["entity_grid"]["cell_h"].as<uint16_t>(),
+      writer
+    );
   }
   // Layers.
-  std::queue<uint32_t> layer_offsets;
+  const auto& layer_blocks = config["layer_blocks"];
+  const auto& sparse_layers = config["sparse_layers"];
+  size_t layer_index = 0;
   for (const auto& layer : map.layers) {
     if (layer.type != Layer::Type::Bounds) {
-      layer_offsets.push(offset + static_cast<uint32_t>(p - buf));
-      size_t size;
-      write_layer(
-        layer,
-        map.w,
-        map.h,
-        buf ? p : nullptr,
-        &size
-      );
-      p += size;
-    }
-  }
-  for (const auto& tileset : map.map_tilesets) {
-    // Map tileset offsets.
-    map_tileset_offsets.push_back(offset + static_cast<uint32_t>(p - buf));
-    // Map tilesets.
-    size_t size;
-    uint32_t* source_offset_entry;
-    uint32_t* library_offset_entry;
-    ultra::sdk::write_tileset(
-      tileset.tileset,
-      buf ? p : nullptr,
-      &size,
-      &source_offset_entry,
-      &map_tileset_tile_offset_entries,
-      &library_offset_entry
-    );
-    map_tileset_source_offset_entries.push_back(source_offset_entry);
-    map_tileset_library_offset_entries.push_back(library_offset_entry);
-    p += size;
-    // Map tileset sources.
-    map_tileset_sources.push_back(p);
-    p += tileset.tileset.source.size() + 1;
-    for (const auto& pair : tileset.tileset.tiles) {
-      // Map tiles.
-      map_tileset_tiles.push_back(p);
-      ultra::sdk::write_tileset_tile(
-        pair.first,
-        pair.second,
-        nullptr,
-        &size,
-        nullptr,
-        nullptr
-      );
-      p += size;
-      // Map tile libraries.
-      map_tileset_tile_libraries.push_back(p);
-      p += pair.second.library.size() + 1;
-      // Map tile collision box types.
-      for (const auto& pair : pair.second.collision_boxes) {
-        map_tileset_tile_collision_box_types.push_back(p);
-        write_tileset_tile_collision_box_type(
-          pair.first,
-          pair.second,
-          nullptr,
-          &size,
-          nullptr
+      layer_offsets[layer_index++].set_offset(writer.offset());
+      write_layer_header(layer, writer);
+      // Encode layers with few enough tiles sparsely.
+      if (sparse_layers.IsDefined()) {
+        auto occupied = layer.tiles.size() - std::count(
+          layer.tiles.begin(),
+          layer.tiles.end(),
+          0
         );
-        p += size;
-        // Map tile collision boxes.
-        for (const auto& pair : pair.second) {
-          map_tileset_tile_collision_box_lists.push_back(p);
-          write_tileset_tile_collision_box_list(
-            pair.first,
-            pair.second,
-            nullptr,
-            &size
-          );
-          p += size;
+        if (occupied <= layer.tiles.size()
+            * sparse_layers["max_occupancy"].as<double>(0.25)) {
+          writer.write<uint8_t>(LayerEncoding::Sparse);
+          write_layer_spans(layer, map.w, map.h, writer);
+          continue;
         }
+        writer.write<uint8_t>(LayerEncoding::Dense);
+      }
+      if (layer_blocks.IsDefined()) {
+        write_layer_blocks(
+          layer,
+          map.w,
+          map.h,
+          layer_blocks["size"].as<uint16_t>(16),
+          layer_blocks["morton"].as<bool>(false),
+          layer_blocks["compress"].as<bool>(false),
+          writer
+        );
+      } else {
+        writer.write_bytes(
+          layer.tiles.data(),
+          layer.tiles.size() * sizeof(uint16_t)
+        );
       }
     }
-    // Map tileset libraries.
-    map_tileset_libraries.push_back(p);
-    p += tileset.tileset.library.size() + 1;
   }
-  for (const auto& tileset : map.entity_tilesets) {
+  if (tilesets != nullptr) {
+    return;
+  }
+  // Leave out tiles the map doesn't use.
+  bool strip_tiles = config["strip_tiles"].as<bool>(false);
+  auto get_tileset = [&](const Tileset& tileset) {
+    return strip_tiles ? strip_tileset(*tileset.tileset, map.tile_usage)
+      : tileset.tileset;
+  };
+  // Map tilesets.
+  std::vector<uint32_t> map_tileset_positions;
+  for (int i = 0; i < map.map_tilesets.size(); i++) {
+    map_tileset_positions.push_back(writer.offset());
+    map_tileset_offsets[i].set_offset(writer.offset());
+    write_full_tileset(
+      *get_tileset(map.map_tilesets[i]),
+      format,
+      blob,
+      writer
+    );
+  }
+  // Entity tilesets.
+  for (int i = 0; i < map.entity_tilesets.size(); i++) {
+    auto entity_tileset = get_tileset(map.entity_tilesets[i]);
+    const auto& tileset = *entity_tileset;
     bool found = false;
-    auto it = map_tileset_offsets.begin();
-    for (int i = 0; i < map.map_tilesets.size(); i++) {
-      if (map.map_tilesets[i].tileset.source == tileset.tileset.source) {
-        entity_tileset_offsets.push_back(*it);
+    for (int j = 0; j < map.map_tilesets.size(); j++) {
+      if (map.map_tilesets[j].tileset->source == tileset.source) {
+        entity_tileset_offsets[i].set_offset(map_tileset_positions[j]);
         found = true;
         break;
       }
-      it++;
     }
     if (!found) {
-      // Entity tileset offsets.
-      entity_tileset_offsets.push_back(offset + static_cast<uint32_t>(p - buf));
-      // Entity tilesets.
-      size_t size;
-      uint32_t* source_offset_entry;
-      uint32_t* library_offset_entry;
-      ultra::sdk::write_tileset(
-        tileset.tileset,
-        buf ? p : nullptr,
-        &size,
-        &source_offset_entry,
-        &entity_tileset_tile_offset_entries,
-        &library_offset_entry
+      entity_tileset_offsets[i].set_offset(writer.offset());
+      auto patches = ultra::sdk::write_tileset(
+        tileset,
+        writer,
+        format.lookup
       );
-      entity_tileset_source_offset_entries.push_back(source_offset_entry);
-      entity_tileset_library_offset_entries.push_back(library_offset_entry);
-      p += size;
-      // Entity tileset sources.
-      entity_tileset_sources.push_back(p);
-      p += tileset.tileset.source.size() + 1;
-      // Entity tileset libraries.
-      entity_tileset_libraries.push_back(p);
-      p += tileset.tileset.library.size() + 1;
+      // Entity tileset source.
+      write_string(patches.source, tileset.source, format, blob, writer);
+      // Entity tileset library.
+      write_string(patches.library, tileset.library, format, blob, writer);
       // Entity tiles.
-      for (const auto& pair : tileset.tileset.tiles) {
-        entity_tileset_tiles.push_back(p);
-        ultra::sdk::write_tileset_tile(
-          pair.first,
-          pair.second,
-          nullptr,
-          &size,
-          nullptr,
-          nullptr
-        );
-        p += size;
-        // Entity tile libraries.
-        entity_tileset_tile_libraries.push_back(p);
-        p += pair.second.library.size() + 1;
-        // Entity tile collision box types.
-        for (const auto& pair : pair.second.collision_boxes) {
-          entity_tileset_tile_collision_box_types.push_back(p);
-          write_tileset_tile_collision_box_type(
-            pair.first,
-            pair.second,
-            nullptr,
-            &size,
-            nullptr
-          );
-          p += size;
-          // Entity tile collision boxes.
-          for (const auto& pair : pair.second) {
-            entity_tileset_tile_collision_box_lists.push_back(p);
-            write_tileset_tile_collision_box_list(
-              pair.first,
-              pair.second,
-              nullptr,
-              &size
-            );
-            p += size;
-          }
-        }
-      }
+      write_tileset_tiles(tileset, patches, format, blob, writer);
     }
   }
-  if (buf != nullptr) {
-    // Position.
-    *x = map.x;
-    *y = map.y;
-    // Dimensions.
-    *w = map.w;
-    *h = map.h;
-    // Properties.
-    *properties_count = map.properties.size() / 2;
-    for (int i = 0; i < map.properties.size(); i++) {
-      *properties[i] = map.properties[i];
-    }
-    // Map tileset count.
-    *MTSn = map.map_tilesets.size();
-    // Entity tileset count.
-    *ETSn = map.entity_tilesets.size();
-    // Layer count.
-    *Ln = map.layers.size();
-    // Entity count.
-    *En = map.entities.size();
-    // Sorted entity indexes.
-    for (int i = 0; i < map.entities.size(); i++) {
-      *x_sorted_min_ptrs[i] = x_sorted_min[i];
-    }
-    for (int i = 0; i < map.entities.size(); i++) {
-      *x_sorted_max_ptrs[i] = x_sorted_max[i];
-    }
-    for (int i = 0; i < map.entities.size(); i++) {
-      *y_sorted_min_ptrs[i] = y_sorted_min[i];
-    }
-    for (int i = 0; i < map.entities.size(); i++) {
-      *y_sorted_max_ptrs[i] = y_sorted_max[i];
-    }
-    // Map tilesets offsets.
-    for (int i = 0; i < map.map_tilesets.size(); i++) {
-      *map_tileset_offset_entries.front() = map_tileset_offsets.front();
-      map_tileset_offset_entries.pop_front();
-      map_tileset_offsets.pop_front();
-    }
-    // Entity tilesets offsets.
-    for (int i = 0; i < map.entity_tilesets.size(); i++) {
-      *entity_tileset_offset_entries.front() = entity_tileset_offsets.front();
-      entity_tileset_offset_entries.pop_front();
-      entity_tileset_offsets.pop_front();
-    }
-    // Layer offsets.
-    for (int i = 0; i < map.layers.size(); i++) {
-      *layer_offset_entries.front() = layer_offsets.front();
-      layer_offset_entries.pop();
-      layer_offsets.pop();
-    }
-    for (const auto& tileset : map.map_tilesets) {
-      uint8_t* p;
-      // Map tileset source offsets.
-      p = map_tileset_sources.front();
-      map_tileset_sources.pop_front();
-      *map_tileset_source_offset_entries.front() =
-        offset + static_cast<uint32_t>(p - buf);
-      map_tileset_source_offset_entries.pop_front();
-      // Map tileset sources.
-      std::copy(
-        tileset.tileset.source.begin(),
-        tileset.tileset.source.end(),
-        p
-      );
-      p[tileset.tileset.source.size()] = '\0';
-      std::list<uint32_t*> map_tileset_tile_library_offset_entries;
-      std::list<uint32_t*> map_tileset_tile_collision_box_type_offset_entries;
-      std::list<uint32_t*> map_tileset_tile_collision_box_list_offset_entries;
-      // Map tileset library offsets.
-      p = map_tileset_libraries.front();
-      map_tileset_libraries.pop_front();
-      *map_tileset_library_offset_entries.front() =
-        offset + static_cast<uint32_t>(p - buf);
-      map_tileset_library_offset_entries.pop_front();
-      // Map tileset libraries.
-      std::copy(
-        tileset.tileset.library.begin(),
-        tileset.tileset.library.end(),
-        p
-      );
-      p[tileset.tileset.library.size()] = '\0';
-      for (const auto& pair : tileset.tileset.tiles) {
-        // Map tile offsets.
-        p = map_tileset_tiles.front();
-        map_tileset_tiles.pop_front();
-        *map_tileset_tile_offset_entries.front() =
-          offset + static_cast<uint32_t>(p - buf);
-        map_tileset_tile_offset_entries.pop_front();
-        // Map tiles.
-        uint32_t* library_offset;
-        ultra::sdk::write_tileset_tile(
-          pair.first,
-          pair.second,
-          p,
-          nullptr,
-          &map_tileset_tile_collision_box_type_offset_entries,
-          &library_offset
-        );
-        map_tileset_tile_library_offset_entries.push_back(library_offset);
-        // Map tile library offsets.
-        p = map_tileset_tile_libraries.front();
-        map_tileset_tile_libraries.pop_front();
-        *map_tileset_tile_library_offset_entries.front() =
-          offset + static_cast<uint32_t>(p - buf);
-        map_tileset_tile_library_offset_entries.pop_front();
-        // Map tile libraries.
-        std::copy(
-          pair.second.library.begin(),
-          pair.second.library.end(),
-          p
-        );
-        p[pair.second.library.size()] = '\0';
-        for (const auto& pair : pair.second.collision_boxes) {
-          // Map tile collision box type offsets.
-          p = map_tileset_tile_collision_box_types.front();
-          map_tileset_tile_collision_box_types.pop_front();
-          *map_tileset_tile_collision_box_type_offset_entries.front() =
-            offset + static_cast<uint32_t>(p - buf);
-          map_tileset_tile_collision_box_type_offset_entries.pop_front();
-          // Map tile collision box types.
-          write_tileset_tile_collision_box_type(
-            pair.first,
-            pair.second,
-            p,
-            nullptr,
-            &map_tileset_tile_collision_box_list_offset_entries
-          );
-          for (const auto& pair : pair.second) {
-            p = map_tileset_tile_collision_box_lists.front();
-            // Map tile collision box offsets.
-            map_tileset_tile_collision_box_lists.pop_front();
-            *map_tileset_tile_collision_box_list_offset_entries.front() =
-              offset + static_cast<uint32_t>(p - buf);
-            map_tileset_tile_collision_box_list_offset_entries.pop_front();
-            // Map tile collision boxes.
-            write_tileset_tile_collision_box_list(
-              pair.first,
-              pair.second,
-              p,
-              nullptr
-            );
-          }
-        }
+}
+
+static void write_boundary(
+  const Boundary<std::list>& boundary,
+  ultra::sdk::Writer& writer
+) {
+  writer.write<uint8_t>(boundary.flags);
+  writer.write<uint16_t>(boundary.size());
+  for (const auto& point : boundary) {
+    writer.write<int32_t>(point.x);
+    writer.write<int32_t>(point.y);
+  }
+}
+
+// Clip a boundary to a rectangle, adding the pieces inside it to partition.
+// The rectangle includes its edges.
+static void clip_boundary(
+  const Boundary<std::list>& boundary,
+  int32_t min_x,
+  int32_t min_y,
+  int32_t max_x,
+  int32_t max_y,
+  std::vector<Boundary<std::list>>& partition
+) {
+  std::vector<Boundary<std::list>> pieces;
+  // Whether the last piece ends at the current point, and whether the first
+  // piece starts at the first point.
+  bool continues = false;
+  bool starts_at_first = false;
+  for (auto a = boundary.begin(), b = std::next(a);
+       a != boundary.end() && b != boundary.end();
+       a++, b++) {
+    // Clip the segment from a to b with Liang-Barsky.
+    double t0 = 0;
+    double t1 = 1;
+    double dx = b->x - a->x;
+    double dy = b->y - a->y;
+    auto clip = [&](double p, double q) {
+      if (p == 0) {
+        return q >= 0;
       }
-    }
-    for (const auto& tileset : map.entity_tilesets) {
-      bool found = false;
-      for (int i = 0; i < map.map_tilesets.size(); i++) {
-        if (map.map_tilesets[i].tileset.source == tileset.tileset.source) {
-          found = true;
-          break;
-        }
+      double t = q / p;
+      if (p < 0) {
+        t0 = std::max(t0, t);
+      } else {
+        t1 = std::min(t1, t);
       }
-      if (!found) {
-        uint8_t* p;
-        // Entity tileset sources.
-        p = entity_tileset_sources.front();
-        entity_tileset_sources.pop_front();
-        *entity_tileset_source_offset_entries.front() =
-          offset + static_cast<uint32_t>(p - buf);
-        entity_tileset_source_offset_entries.pop_front();
-        // Entity tileset sources.
-        std::copy(
-          tileset.tileset.source.begin(),
-          tileset.tileset.source.end(),
-          p
-        );
-        p[tileset.tileset.source.size()] = '\0';
-        // Entity tileset library offsets.
-        p = entity_tileset_libraries.front();
-        entity_tileset_libraries.pop_front();
-        *entity_tileset_library_offset_entries.front() =
-          offset + static_cast<uint32_t>(p - buf);
-        entity_tileset_library_offset_entries.pop_front();
-        // Entity tileset libraries.
-        std::copy(
-          tileset.tileset.library.begin(),
-          tileset.tileset.library.end(),
-          p
-        );
-        p[tileset.tileset.library.size()] = '\0';
-        std::list<uint32_t*> entity_tileset_tile_library_offset_entries;
-        std::list<uint32_t*>
-          entity_tileset_tile_collision_box_type_offset_entries;
-        std::list<uint32_t*>
-          entity_tileset_tile_collision_box_list_offset_entries;
-        for (const auto& pair : tileset.tileset.tiles) {
-          // Entity tile offsets.
-          uint8_t* p = entity_tileset_tiles.front();
-          entity_tileset_tiles.pop_front();
-          *entity_tileset_tile_offset_entries.front() =
-            offset + static_cast<uint32_t>(p - buf);
-          entity_tileset_tile_offset_entries.pop_front();
-          // Entity tiles.
-          uint32_t* library_offset;
-          ultra::sdk::write_tileset_tile(
-            pair.first,
-            pair.second,
-            p,
-            nullptr,
-            &entity_tileset_tile_collision_box_type_offset_entries,
-            &library_offset
-          );
-          entity_tileset_tile_library_offset_entries.push_back(library_offset);
-          // Entity tile library offsets.
-          p = entity_tileset_tile_libraries.front();
-          entity_tileset_tile_libraries.pop_front();
-          *entity_tileset_tile_library_offset_entries.front() =
-            offset + static_cast<uint32_t>(p - buf);
-          entity_tileset_tile_library_offset_entries.pop_front();
-          // Entity tile libraries.
-          std::copy(
-            pair.second.library.begin(),
-            pair.second.library.end(),
-            p
-          );
-          p[pair.second.library.size()] = '\0';
-          for (const auto& pair : pair.second.collision_boxes) {
-            // Entity tile collision box type offsets.
-            p = entity_tileset_tile_collision_box_types.front();
-            entity_tileset_tile_collision_box_types.pop_front();
-            *entity_tileset_tile_collision_box_type_offset_entries.front() =
-              offset + static_cast<uint32_t>(p - buf);
-            entity_tileset_tile_collision_box_type_offset_entries.pop_front();
-            // Entity tile collision box types.
-            write_tileset_tile_collision_box_type(
-              pair.first,
-              pair.second,
-              p,
-              nullptr,
-              &entity_tileset_tile_collision_box_list_offset_entries
-            );
-            for (const auto& pair : pair.second) {
-              // Entity tile collision box offsets.
-              p = entity_tileset_tile_collision_box_lists.front();
-              entity_tileset_tile_collision_box_lists.pop_front();
-              *entity_tileset_tile_collision_box_list_offset_entries.front() =
-                offset + static_cast<uint32_t>(p - buf);
-              entity_tileset_tile_collision_box_list_offset_entries.pop_front();
-              // Entity tile collision boxes.
-              write_tileset_tile_collision_box_list(
-                pair.first,
-                pair.second,
-                p,
-                nullptr
-              );
-            }
-          }
-        }
+      return t0 < t1;
+    };
+    if (!clip(-dx, a->x - min_x)
+        || !clip(dx, max_x - a->x)
+        || !clip(-dy, a->y - min_y)
+        || !clip(dy, max_y - a->y)) {
+      continues = false;
+      continue;
+    }
+    Point start = {
+      .x = static_cast<int32_t>(a->x + std::lround(t0 * dx)),
+      .y = static_cast<int32_t>(a->y + std::lround(t0 * dy)),
+    };
+    Point end = {
+      .x = static_cast<int32_t>(a->x + std::lround(t1 * dx)),
+      .y = static_cast<int32_t>(a->y + std::lround(t1 * dy)),
+    };
+    if (continues && t0 == 0) {
+      pieces.back().push_back(end);
+    } else {
+      if (pieces.empty() && a == boundary.begin() && t0 == 0) {
+        starts_at_first = true;
       }
+      pieces.emplace_back();
+      pieces.back().flags = boundary.flags;
+      pieces.back().push_back(start);
+      pieces.back().push_back(end);
     }
+    continues = t1 == 1;
   }
-  if (buf_size != nullptr) {
-    *buf_size = p - buf;
+  // Rejoin a closed boundary that was cut where it starts.
+  const auto& first = boundary.front();
+  const auto& last = boundary.back();
+  if (pieces.size() > 1 && starts_at_first && continues
+      && first.x == last.x && first.y == last.y) {
+    auto& piece = pieces.back();
+    piece.insert(
+      piece.end(),
+      std::next(pieces.front().begin()),
+      pieces.front().end()
+    );
+    pieces.erase(pieces.begin());
   }
+  std::move(pieces.begin(), pieces.end(), std::back_inserter(partition));
 }
 
-static void write_boundary(
-  const Boundary<std::list>& boundary,
-  uint8_t* buf,
-  size_t* buf_size
+// Split boundaries at map edges, so that each map carries the boundaries
+// inside it. Boundaries along an edge between maps go to both.
+static std::vector<std::vector<Boundary<std::list>>> partition_boundaries(
+  const std::vector<Map>& maps,
+  const std::list<Boundary<std::list>>& bounds
 ) {
-  uint8_t* p = buf;
-  uint8_t* flags = reinterpret_cast<uint8_t*>(p);
-  p += sizeof(uint8_t);
-  uint16_t* BLn = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  std::queue<std::pair<int32_t*, int32_t*>> points;
-  for (const auto& point : boundary) {
-    int32_t* x = reinterpret_cast<int32_t*>(p);
-    p += sizeof(int32_t);
-    int32_t* y = reinterpret_cast<int32_t*>(p);
-    p += sizeof(int32_t);
-    points.push(std::make_pair(x, y));
-  }
-  if (buf != nullptr) {
-    *flags = boundary.flags;
-    *BLn = boundary.size();
+  std::vector<std::vector<Boundary<std::list>>> partitions(maps.size());
+  for (const auto& boundary : bounds) {
+    if (boundary.empty()) {
+      continue;
+    }
+    int32_t min_x = boundary.front().x;
+    int32_t min_y = boundary.front().y;
+    int32_t max_x = min_x;
+    int32_t max_y = min_y;
     for (const auto& point : boundary) {
-      auto ptrs = points.front();
-      points.pop();
-      *ptrs.first = point.x;
-      *ptrs.second = point.y;
+      min_x = std::min(min_x, point.x);
+      min_y = std::min(min_y, point.y);
+      max_x = std::max(max_x, point.x);
+      max_y = std::max(max_y, point.y);
+    }
+    for (size_t i = 0; i < maps.size(); i++) {
+      const auto& map = maps[i];
+      int32_t map_min_x = map.x << 4;
+      int32_t map_min_y = map.y << 4;
+      int32_t map_max_x = (map.x + map.w) << 4;
+      int32_t map_max_y = (map.y + map.h) << 4;
+      if (min_x <= map_max_x && map_min_x <= max_x
+          && min_y <= map_max_y && map_min_y <= max_y) {
+        clip_boundary(
+          boundary,
+          map_min_x,
+          map_min_y,
+          map_max_x,
+          map_max_y,
+          partitions[i]
+        );
+      }
     }
   }
-  if (buf_size != nullptr) {
-    *buf_size = p - buf;
+  return partitions;
+}
+
+// Write the boundaries of one map.
+static void write_boundary_partition(
+  const std::vector<Boundary<std::list>>& partition,
+  ultra::sdk::Writer& writer
+) {
+  writer.write<uint16_t>(partition.size());
+  auto boundary_offsets = writer.reserve<uint32_t>(partition.size());
+  for (size_t i = 0; i < partition.size(); i++) {
+    boundary_offsets[i].set(writer.offset());
+    write_boundary(partition[i], writer);
   }
 }
 
-static void write_world(
-  const std::vector<Map>& maps,
+// Write a hierarchy over the segments of every boundary.
+static void write_boundary_bvh(
   const std::list<Boundary<std::list>>& bounds,
-  YAML::Node& config,
-  uint8_t* buf,
-  size_t* buf_size
+  size_t leaf_size,
+  ultra::sdk::Writer& writer
 ) {
-  uint8_t* p = buf;
-  uint16_t* Mn = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  std::queue<uint32_t*> map_header_offset_entries;
-  for (int i = 0; i < maps.size(); i++) {
-    map_header_offset_entries.push(reinterpret_cast<uint32_t*>(p));
-    p += sizeof(uint32_t);
-  }
-  uint16_t* Bn = reinterpret_cast<uint16_t*>(p);
-  p += sizeof(uint16_t);
-  std::queue<uint32_t*> boundary_offset_entries;
-  for (int i = 0; i < bounds.size(); i++) {
-    boundary_offset_entries.push(reinterpret_cast<uint32_t*>(p));
-    p += sizeof(uint32_t);
-  }
-  std::queue<uint32_t> map_header_offsets;
-  std::unordered_map<uint16_t, uint16_t> type_ids;
-  for (const auto& map : maps) {
-    map_header_offsets.push(static_cast<uint32_t>(p - buf));
-    size_t map_header_size;
-    write_map(
-      map,
-      config,
-      type_ids,
-      static_cast<uint32_t>(p - buf),
-      buf ? p : nullptr,
-      &map_header_size
-    );
-    p += map_header_size;
-  }
-  std::queue<uint32_t> boundary_offsets;
+  std::vector<ultra::sdk::BvhSegment> segments;
+  uint16_t boundary = 0;
   for (const auto& points : bounds) {
-    boundary_offsets.push(static_cast<uint32_t>(p - buf));
-    size_t boundary_size;
-    write_boundary(points, buf ? p : nullptr, &boundary_size);
-    p += boundary_size;
-  }
-  if (buf != nullptr) {
-    *Mn = maps.size();
-    *Bn = bounds.size();
-    for (const auto& map : maps) {
-      *map_header_offset_entries.front() = map_header_offsets.front();
-      map_header_offset_entries.pop();
-      map_header_offsets.pop();
-    }
-    for (const auto& points : bounds) {
-      *boundary_offset_entries.front() = boundary_offsets.front();
-      boundary_offset_entries.pop();
-      boundary_offsets.pop();
+    uint16_t point = 0;
+    for (auto a = points.begin(), b = std::next(a);
+         a != points.end() && b != points.end();
+         a++, b++) {
+      segments.push_back({a->x, a->y, b->x, b->y, boundary, point++});
     }
+    boundary++;
   }
-  if (buf_size != nullptr) {
-    *buf_size = p - buf;
-  }
+  ultra::sdk::write_bvh(std::move(segments), leaf_size, writer);
 }
 
-enum BoundsTile {
-  Empty   = 0x00,
-  Slope   = 0x01,
-  Down    = 0x03,
-  Ceil    = 0x04,
-  Half    = 0x08,
-  Tall    = 0x11,
-  Solid   = 0x20,
-  OneWay  = 0x40,
-};
-
-const static std::unordered_map<uint8_t, std::list<Point>> geometry = {
-  {Empty, {}},
-  {Solid, {{0, 0}, {16, 0}, {16, 16}, {0, 16}}},
-  {Slope, {{0, 16}, {16, 0}, {16, 16}}},
-  {Slope | Down, {{0, 0}, {16, 16}, {0, 16}}},
-  {Slope | Down | Ceil, {{0, 0}, {16, 0}, {16, 16}}},
-  {Slope | Ceil, {{0, 0}, {16, 0}, {0, 16}}},
-  {Slope | Half, {{0, 16}, {16, 8}, {16, 16}}},
-  {Slope | Half | Tall, {{0, 8}, {16, 0}, {16, 16}, {0, 16}}},
-  {Slope | Half | Tall | Down, {{0, 0}, {16, 8}, {16, 16}, {0, 16}}},
-  {Slope | Half | Down, {{0, 8}, {16, 16}, {0, 16}}},
-  {Slope | Half | Ceil, {{0, 0}, {16, 0}, {0, 8}}},
-  {Slope | Half | Ceil | Tall, {{0, 0}, {16, 0}, {16, 8}, {0, 16}}},
-  {Slope | Half | Ceil | Tall | Down, {{0, 0}, {16, 0}, {16, 16}, {0, 8}}},
-  {Slope | Half | Ceil | Down, {{0, 0}, {16, 0}, {16, 8}}},
-  {Half, {{0, 8}, {16, 8}, {16, 16}, {0, 16}}},
-  {Half | Ceil, {{0, 0}, {16, 0}, {16, 8}, {0, 8}}},
-  {(OneWay | Solid) + 0, {{0, 0}, {16, 0}}},
-  {(OneWay | Solid) + 1, {{16, 0}, {16, 16}}},
-  {(OneWay | Solid) + 2, {{16, 16}, {0, 16}}},
-  {(OneWay | Solid) + 3, {{0, 16}, {0, 0}}},
-  {OneWay | Slope, {{0, 16}, {16, 0}}},
-  {OneWay | Slope | Down, {{0, 0}, {16, 16}}},
-  {OneWay | Slope | Down | Ceil, {{16, 16}, {0, 0}}},
-  {OneWay | Slope | Ceil, {{16, 0}, {0, 16}}},
-  {OneWay | Slope | Half, {{0, 16}, {16, 8}}},
-  {OneWay | Slope | Half | Tall, {{0, 8}, {16, 0}}},
-  {OneWay | Slope | Half | Tall | Down, {{0, 0}, {16, 8}}},
-  {OneWay | Slope | Half | Down, {{0, 8}, {16, 16}}},
-  {OneWay | Slope | Half | Ceil, {{16, 0}, {0, 8}}},
-  {OneWay | Slope | Half | Ceil | Tall, {{16, 8}, {0, 16}}},
-  {OneWay | Slope | Half | Ceil | Tall | Down, {{16, 16}, {0, 8}}},
-  {OneWay | Slope | Half | Ceil | Down, {{16, 8}, {0, 0}}},
-  {OneWay | Half, {{0, 8}, {16, 8}}},
-  {OneWay | Half | Ceil, {{16, 8}, {0, 8}}},
-};
-
-template<typename T>
-static typename T::iterator next_wrap(
-  T& in,
-  typename T::iterator it
+static Blob serialize_map(
+  const Map& map,
+  YAML::Node& config,
+  TilesetTable* tilesets
 ) {
-  auto next = std::next(it);
-  if (next == in.end()) {
-    return in.begin();
-  }
-  return next;
+  Blob blob;
+  ultra::sdk::Writer writer;
+  write_map(map, config, tilesets, blob, writer);
+  blob.data.assign(writer.data(), writer.data() + writer.size());
+  blob.relocations = writer.relocations();
+  return blob;
+}
+
+// Write a blob, rebasing its offsets onto its position in the world and
+// adding its strings to the world's string pool.
+static uint32_t write_blob(
+  const Blob& blob,
+  ultra::sdk::StringPool& strings,
+  ultra::sdk::Writer& writer
+) {
+  uint32_t base = writer.offset();
+  writer.write_bytes(blob.data.data(), blob.data.size());
+  for (auto offset : blob.relocations) {
+    uint32_t value;
+    std::memcpy(&value, &blob.data[offset], sizeof(value));
+    value += base;
+    writer.patch(base + offset, &value, sizeof(value));
+  }
+  for (const auto& ref : blob.string_refs) {
+    strings.add(base + ref.offset, ref.string);
+  }
+  return base;
+}
+
+static void write_map_blob(
+  const Blob& blob,
+  std::unordered_map<uint16_t, uint16_t>& type_ids,
+  std::unordered_map<std::string, uint16_t>& tileset_indexes,
+  ultra::sdk::StringPool& strings,
+  ultra::sdk::Writer& writer
+) {
+  uint32_t base = write_blob(blob, strings, writer);
+  // Number indexed entities in world order.
+  for (const auto& entity : blob.indexed_entities) {
+    type_ids.emplace(entity.type, 1);
+    uint16_t id = type_ids[entity.type]++;
+    writer.patch(base + entity.id_offset, &id, sizeof(id));
+  }
+  // Number shared tilesets in the order the world first refers to them.
+  for (const auto& ref : blob.tileset_refs) {
+    uint16_t index = tileset_indexes.emplace(
+      ref.key,
+      tileset_indexes.size()
+    ).first->second;
+    writer.patch(base + ref.index_offset, &index, sizeof(index));
+  }
+}
+
+// Bump when the model or serialized map format changes.
+static const char* cache_version = "ultra-sdk-world cache 4";
+
+class ArtifactReader {
+public:
+  explicit ArtifactReader(const std::string& path) : offset(0) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("Could not open cache artifact");
+    }
+    data.assign(std::istreambuf_iterator<char>(file), {});
+  }
+
+  template<typename T>
+  T read() {
+    T value;
+    read_bytes(&value, sizeof(T));
+    return value;
+  }
+
+  void read_bytes(void* value, size_t size) {
+    if (size > data.size() - offset) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+    std::memcpy(value, data.data() + offset, size);
+    offset += size;
+  }
+
+  std::string read_string() {
+    auto end = data.find('\0', offset);
+    if (end == std::string::npos) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+    std::string value = data.substr(offset, end - offset);
+    offset = end + 1;
+    return value;
+  }
+
+private:
+  std::string data;
+  size_t offset;
+};
+
+static std::string read_file(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// Key a map by everything its artifacts are built from: the config, its
+// position in the world, and the contents of its TMX and TSX files.
+static std::string map_cache_key(
+  const std::string& path,
+  const std::string& prefix,
+  int16_t x,
+  int16_t y,
+  const std::string& config_data,
+  std::vector<std::string>& inputs
+) {
+  uint64_t hash = 0xcbf29ce484222325;
+  hash = hash_field(hash, cache_version);
+  hash = hash_field(hash, config_data);
+  hash = hash_field(hash, std::to_string(x) + "," + std::to_string(y));
+  inputs.push_back(path);
+  auto map_data = read_file(path);
+  hash = hash_field(hash, map_data);
+  // Hash tilesets in the order the map references them.
+  std::vector<char> map_text(map_data.begin(), map_data.end());
+  map_text.push_back('\0');
+  rapidxml::xml_document<> map_doc;
+  map_doc.parse<0>(map_text.data());
+  for (auto node = map_doc.first_node()->first_node("tileset");
+       node != nullptr;
+       node = node->next_sibling("tileset")) {
+    auto source = node->first_attribute("source");
+    if (source != nullptr) {
+      inputs.push_back(prefix + source->value());
+      hash = hash_field(hash, read_file(inputs.back()));
+    }
+  }
+  char key[17];
+  std::snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+  return key;
+}
+
+// Atomically replace path with what write stores into a Writer. If write
+// throws, path is left as it was.
+template<typename F>
+static void write_artifact(const std::string& path, F write) {
+  auto temp_path = path + ".tmp";
+  try {
+    ultra::sdk::Writer writer(temp_path.c_str());
+    write(writer);
+    writer.flush();
+  } catch (...) {
+    std::filesystem::remove(temp_path);
+    throw;
+  }
+  std::filesystem::rename(temp_path, path);
+}
+
+static void save_map_model(
+  const Map& map,
+  const std::vector<Layer>& bounds,
+  const std::string& path
+) {
+  write_artifact(path, [&](ultra::sdk::Writer& writer) {
+    writer.write<int16_t>(map.x);
+    writer.write<int16_t>(map.y);
+    writer.write<uint16_t>(map.w);
+    writer.write<uint16_t>(map.h);
+    writer.write<uint32_t>(bounds.size());
+    for (const auto& layer : bounds) {
+      write_layer_header(layer, writer);
+      writer.write_bytes(
+        layer.tiles.data(),
+        layer.tiles.size() * sizeof(uint16_t)
+      );
+    }
+    writer.write<uint32_t>(map.names.size());
+    for (const auto& pair : map.names) {
+      writer.write<uint32_t>(pair.first);
+      writer.write_string(pair.second);
+    }
+    writer.write<uint32_t>(map.tile_usage.size());
+    for (const auto& pair : map.tile_usage) {
+      writer.write_string(pair.first);
+      writer.write<uint32_t>(pair.second.size());
+      for (auto tile_id : pair.second) {
+        writer.write<uint16_t>(tile_id);
+      }
+    }
+  });
+}
+
+// Load what the rest of the build needs from a map that is not parsed.
+static Map load_map_model(
+  const std::string& path,
+  std::vector<Layer>& bounds
+) {
+  ArtifactReader reader(path);
+  Map map = {};
+  map.x = reader.read<int16_t>();
+  map.y = reader.read<int16_t>();
+  map.w = reader.read<uint16_t>();
+  map.h = reader.read<uint16_t>();
+  auto bounds_count = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < bounds_count; i++) {
+    Layer layer = {
+      .type = Layer::Type::Bounds,
+    };
+    layer.name = reader.read<uint32_t>();
+    std::get<0>(layer.parallax.x) = reader.read<uint8_t>();
+    std::get<1>(layer.parallax.x) = reader.read<uint8_t>();
+    std::get<0>(layer.parallax.y) = reader.read<uint8_t>();
+    std::get<1>(layer.parallax.y) = reader.read<uint8_t>();
+    layer.tiles.resize(map.w * map.h);
+    reader.read_bytes(
+      layer.tiles.data(),
+      layer.tiles.size() * sizeof(uint16_t)
+    );
+    bounds.push_back(std::move(layer));
+  }
+  auto names_count = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < names_count; i++) {
+    auto hash = reader.read<uint32_t>();
+    map.names.emplace(hash, reader.read_string());
+  }
+  auto usage_count = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < usage_count; i++) {
+    auto& used = map.tile_usage[reader.read_string()];
+    auto tile_count = reader.read<uint32_t>();
+    for (uint32_t j = 0; j < tile_count; j++) {
+      used.insert(reader.read<uint16_t>());
+    }
+  }
+  map.cached = true;
+  return map;
+}
+
+static void save_blob(const Blob& blob, const std::string& path) {
+  write_artifact(path, [&](ultra::sdk::Writer& writer) {
+    writer.write<uint32_t>(blob.data.size());
+    writer.write_bytes(blob.data.data(), blob.data.size());
+    writer.write<uint32_t>(blob.relocations.size());
+    writer.write_bytes(
+      blob.relocations.data(),
+      blob.relocations.size() * sizeof(uint32_t)
+    );
+    writer.write<uint32_t>(blob.indexed_entities.size());
+    for (const auto& entity : blob.indexed_entities) {
+      writer.write<uint32_t>(entity.id_offset);
+      writer.write<uint16_t>(entity.type);
+    }
+    writer.write<uint32_t>(blob.tileset_refs.size());
+    for (const auto& ref : blob.tileset_refs) {
+      writer.write<uint32_t>(ref.index_offset);
+      writer.write_string(ref.key);
+      writer.write_string(ref.path);
+    }
+    writer.write<uint32_t>(blob.string_refs.size());
+    for (const auto& ref : blob.string_refs) {
+      writer.write<uint32_t>(ref.offset);
+      writer.write_string(ref.string);
+    }
+  });
+}
+
+static Blob load_blob(const std::string& path) {
+  ArtifactReader reader(path);
+  Blob blob;
+  blob.data.resize(reader.read<uint32_t>());
+  reader.read_bytes(blob.data.data(), blob.data.size());
+  blob.relocations.resize(reader.read<uint32_t>());
+  reader.read_bytes(
+    blob.relocations.data(),
+    blob.relocations.size() * sizeof(uint32_t)
+  );
+  for (auto offset : blob.relocations) {
+    if (offset + sizeof(uint32_t) > blob.data.size()) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+  }
+  blob.indexed_entities.resize(reader.read<uint32_t>());
+  for (auto& entity : blob.indexed_entities) {
+    entity.id_offset = reader.read<uint32_t>();
+    entity.type = reader.read<uint16_t>();
+    if (entity.id_offset + sizeof(uint16_t) > blob.data.size()) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+  }
+  blob.tileset_refs.resize(reader.read<uint32_t>());
+  for (auto& ref : blob.tileset_refs) {
+    ref.index_offset = reader.read<uint32_t>();
+    ref.key = reader.read_string();
+    ref.path = reader.read_string();
+    if (ref.index_offset + sizeof(uint16_t) > blob.data.size()) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+  }
+  blob.string_refs.resize(reader.read<uint32_t>());
+  for (auto& ref : blob.string_refs) {
+    ref.offset = reader.read<uint32_t>();
+    ref.string = reader.read_string();
+    if (ref.offset + sizeof(uint32_t) > blob.data.size()) {
+      throw std::runtime_error("Corrupt cache artifact");
+    }
+  }
+  return blob;
+}
+
+// Section flags for the format options of the world's tilesets.
+static ultra::sdk::SectionFlags get_tileset_flags(YAML::Node& config) {
+  auto flags = ultra::sdk::SectionFlags::None;
+  if (config["tile_lookup"].as<bool>(false)) {
+    flags |= ultra::sdk::SectionFlags::TileLookup;
+  }
+  if (config["share_tile_data"].as<bool>(false)) {
+    flags |= ultra::sdk::SectionFlags::SharedTileData;
+  }
+  if (config["string_pool"].as<bool>(false)) {
+    flags |= ultra::sdk::SectionFlags::PooledStrings;
+  }
+  return flags;
+}
+
+// Section flags for the format options of the world's maps, including the
+// tilesets embedded in them.
+static ultra::sdk::SectionFlags get_map_flags(YAML::Node& config) {
+  auto flags = ultra::sdk::SectionFlags::None;
+  if (config["entity_grid"].IsDefined()) {
+    flags |= ultra::sdk::SectionFlags::EntityGrid;
+  }
+  const auto& layer_blocks = config["layer_blocks"];
+  if (layer_blocks.IsDefined()) {
+    flags |= ultra::sdk::SectionFlags::LayerBlocks;
+    if (layer_blocks["morton"].as<bool>(false)) {
+      flags |= ultra::sdk::SectionFlags::MortonBlocks;
+    }
+    if (layer_blocks["compress"].as<bool>(false)) {
+      flags |= ultra::sdk::SectionFlags::CompressedBlocks;
+    }
+  }
+  if (config["sparse_layers"].IsDefined()) {
+    flags |= ultra::sdk::SectionFlags::SparseLayers;
+  }
+  if (config["shared_tilesets"].as<bool>(false)) {
+    flags |= ultra::sdk::SectionFlags::SharedTilesets;
+  } else {
+    flags |= get_tileset_flags(config);
+  }
+  return flags;
+}
+
+// Reject combinations of config options that can't be written.
+static void check_config(YAML::Node& config) {
+  if (config["partition_boundaries"].as<bool>(false)
+      && config["boundary_bvh"].IsDefined()) {
+    throw std::runtime_error(
+      "Partitioned boundaries can't share a boundary BVH"
+    );
+  }
+}
+
+static void write_world(
+  const std::vector<Map>& maps,
+  const std::list<Boundary<std::list>>& bounds,
+  const std::vector<CollisionGrid>& collision,
+  const HeightTables& heights,
+  YAML::Node& config,
+  MapCache& cache,
+  ultra::sdk::Writer& writer
+) {
+  bool shared_tilesets = config["shared_tilesets"].as<bool>(false);
+  bool strip_tiles = config["strip_tiles"].as<bool>(false);
+  bool string_pool = config["string_pool"].as<bool>(false);
+  const auto& boundary_bvh = config["boundary_bvh"];
+  bool partitioned = config["partition_boundaries"].as<bool>(false);
+  TilesetTable* tilesets = shared_tilesets ? &cache.tilesets : nullptr;
+  cache.tilesets.keys.clear();
+  // Section table.
+  std::optional<ultra::sdk::SectionTable> sections;
+  if (config["section_table"].as<bool>(false)) {
+    sections.emplace(
+      3 + boundary_bvh.IsDefined() + !heights.maps.empty() + shared_tilesets
+        + string_pool,
+      writer
+    );
+    auto flags = ultra::sdk::SectionFlags::None;
+    if (shared_tilesets) {
+      flags |= ultra::sdk::SectionFlags::SharedTilesets;
+    }
+    if (string_pool) {
+      flags |= ultra::sdk::SectionFlags::PooledStrings;
+    }
+    if (partitioned) {
+      flags |= ultra::sdk::SectionFlags::PartitionedBoundaries;
+    }
+    if (!collision.empty()) {
+      flags |= ultra::sdk::SectionFlags::CollisionGrids;
+    }
+    if (!heights.maps.empty()) {
+      flags |= ultra::sdk::SectionFlags::HeightTables;
+    }
+    sections->begin(ultra::sdk::SectionType::Index, flags);
+  }
+  writer.write<uint16_t>(maps.size());
+  auto map_header_offsets = writer.reserve<uint32_t>(maps.size());
+  // Partitioned boundaries are stored with their maps instead.
+  size_t boundary_count = partitioned ? 0 : bounds.size();
+  writer.write<uint16_t>(boundary_count);
+  auto boundary_offsets = writer.reserve<uint32_t>(boundary_count);
+  auto tileset_table_offset = writer.reserve<uint32_t>(shared_tilesets ? 1 : 0);
+  // String pool offset and size.
+  auto string_pool_header = writer.reserve<uint32_t>(string_pool ? 2 : 0);
+  auto boundary_bvh_offset = writer.reserve<uint32_t>(
+    boundary_bvh.IsDefined() ? 1 : 0
+  );
+  auto partition_offsets = writer.reserve<uint32_t>(
+    partitioned ? maps.size() : 0
+  );
+  auto collision_offsets = writer.reserve<uint32_t>(collision.size());
+  auto height_table_offset = writer.reserve<uint32_t>(
+    heights.maps.empty() ? 0 : 1
+  );
+  auto height_offsets = writer.reserve<uint32_t>(heights.maps.size());
+  std::vector<std::vector<Boundary<std::list>>> partitions;
+  if (partitioned) {
+    partitions = partition_boundaries(maps, bounds);
+  }
+  std::unordered_map<uint16_t, uint16_t> type_ids;
+  std::unordered_map<std::string, uint16_t> tileset_indexes;
+  // Files shared tilesets were read from, by key.
+  std::unordered_map<std::string, std::string> tileset_paths;
+  ultra::sdk::StringPool strings;
+  if (sections) {
+    auto flags = get_map_flags(config);
+    if (partitioned) {
+      flags |= ultra::sdk::SectionFlags::PartitionedBoundaries;
+    }
+    if (!collision.empty()) {
+      flags |= ultra::sdk::SectionFlags::CollisionGrids;
+    }
+    if (!heights.maps.empty()) {
+      flags |= ultra::sdk::SectionFlags::HeightTables;
+    }
+    sections->begin(ultra::sdk::SectionType::Maps, flags);
+  }
+  // Only one map is buffered at a time.
+  for (int i = 0; i < maps.size(); i++) {
+    const auto& map = maps[i];
+    std::shared_ptr<const Blob> blob;
+    auto resident = cache.maps.find(map.key);
+    if (resident != cache.maps.end()) {
+      blob = resident->second.blob;
+    }
+    if (blob == nullptr) {
+      auto path = cache.dir + "/" + map.key + ".bin";
+      if (map.cached) {
+        blob = std::make_shared<Blob>(load_blob(path));
+      } else {
+        blob = std::make_shared<Blob>(serialize_map(map, config, tilesets));
+        if (!cache.dir.empty()) {
+          // Save tilesets first, since the map refers to them.
+          for (const auto& ref : blob->tileset_refs) {
+            auto tileset_path = cache.dir + "/" + ref.key + ".tileset";
+            if (!std::filesystem::exists(tileset_path)) {
+              save_blob(*cache.tilesets.blobs.at(ref.key), tileset_path);
+            }
+          }
+          save_blob(*blob, path);
+        }
+      }
+      if (resident != cache.maps.end()) {
+        resident->second.blob = blob;
+      }
+    }
+    map_header_offsets[i].set(writer.offset());
+    write_map_blob(*blob, type_ids, tileset_indexes, strings, writer);
+    for (const auto& ref : blob->tileset_refs) {
+      tileset_paths.emplace(ref.key, ref.path);
+    }
+    if (partitioned) {
+      partition_offsets[i].set(writer.offset());
+      write_boundary_partition(partitions[i], writer);
+    }
+    if (!collision.empty()) {
+      collision_offsets[i].set(writer.offset());
+      writer.write<uint8_t>(collision[i].bits);
+      writer.write_bytes(collision[i].data.data(), collision[i].data.size());
+    }
+    if (!heights.maps.empty()) {
+      height_offsets[i].set(writer.offset());
+      writer.write_bytes(heights.maps[i].data(), heights.maps[i].size());
+    }
+    writer.flush();
+  }
+  if (sections) {
+    sections->begin(ultra::sdk::SectionType::Boundaries);
+  }
+  if (!partitioned) {
+    size_t i = 0;
+    for (const auto& points : bounds) {
+      boundary_offsets[i++].set(writer.offset());
+      write_boundary(points, writer);
+    }
+  }
+  if (boundary_bvh.IsDefined()) {
+    // Boundary hierarchy.
+    if (sections) {
+      sections->begin(ultra::sdk::SectionType::BoundaryBvh);
+    }
+    boundary_bvh_offset.set(writer.offset());
+    write_boundary_bvh(
+      bounds,
+      boundary_bvh["leaf_size"].as<size_t>(4),
+      writer
+    );
+  }
+  if (!heights.maps.empty()) {
+    // Tile shape heights.
+    if (sections) {
+      sections->begin(ultra::sdk::SectionType::Heights);
+    }
+    height_table_offset.set(writer.offset());
+    writer.write<uint8_t>(heights.table.size() / 32);
+    writer.write_bytes(heights.table.data(), heights.table.size());
+  }
+  if (shared_tilesets) {
+    // Shared tilesets.
+    if (sections) {
+      sections->begin(
+        ultra::sdk::SectionType::Tilesets,
+        get_tileset_flags(config)
+      );
+    }
+    tileset_table_offset.set(writer.offset());
+    writer.write<uint16_t>(tileset_indexes.size());
+    auto tileset_offsets = writer.reserve<uint32_t>(tileset_indexes.size());
+    std::vector<std::string> keys(tileset_indexes.size());
+    for (const auto& pair : tileset_indexes) {
+      keys[pair.second] = pair.first;
+    }
+    // Leave out tiles no map in the world uses.
+    TileUsage usage;
+    TilesetFormat format = {};
+    if (strip_tiles) {
+      for (const auto& map : maps) {
+        for (const auto& pair : map.tile_usage) {
+          usage[pair.first].insert(pair.second.begin(), pair.second.end());
+        }
+      }
+      format = {
+        .lookup = config["tile_lookup"].as<bool>(false),
+        .share_data = config["share_tile_data"].as<bool>(false),
+        .pool_strings = string_pool,
+      };
+    }
+    std::unordered_map<std::string, std::shared_ptr<const Blob>> used;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (strip_tiles) {
+        auto tileset = ultra::sdk::read_shared_tileset(
+          tileset_paths.at(keys[i]).c_str()
+        );
+        auto blob = serialize_tileset(*strip_tileset(*tileset, usage), format);
+        tileset_offsets[i].set(write_blob(blob, strings, writer));
+        continue;
+      }
+      auto blob = cache.tilesets.blobs.find(keys[i]);
+      if (blob == cache.tilesets.blobs.end()) {
+        blob = cache.tilesets.blobs.emplace(
+          keys[i],
+          std::make_shared<Blob>(
+            load_blob(cache.dir + "/" + keys[i] + ".tileset")
+          )
+        ).first;
+      }
+      tileset_offsets[i].set(write_blob(*blob->second, strings, writer));
+      used.insert(*blob);
+    }
+    // Keep only the tilesets this world uses.
+    cache.tilesets.blobs = std::move(used);
+  }
+  if (string_pool) {
+    if (sections) {
+      sections->begin(ultra::sdk::SectionType::Strings);
+    }
+    auto offset = strings.write(writer);
+    string_pool_header[0].set(offset);
+    string_pool_header[1].set(writer.offset() - offset);
+  }
+  if (sections) {
+    sections->end();
+  }
+  writer.flush();
 }
 
 static float slope(
@@ -954,261 +1672,606 @@ static float slope(
   return (b.y - a.y) / x;
 }
 
+static uint64_t point_key(const Point& point) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(point.x)) << 32)
+    | static_cast<uint32_t>(point.y);
+}
+
+struct HalfEdgeKey {
+  uint64_t from;
+  uint64_t to;
+  bool operator==(const HalfEdgeKey& other) const {
+    return from == other.from && to == other.to;
+  }
+};
+
+struct HalfEdgeKeyHash {
+  size_t operator()(const HalfEdgeKey& key) const {
+    return std::hash<uint64_t>()(key.from * 0x9e3779b97f4a7c15 ^ key.to);
+  }
+};
+
 static void merge_lines(
   std::list<Boundary<std::list>>& boundaries
 ) {
-  // Join connected tiles.
- loop_lines:
+  // Index lines by their first point.
+  std::vector<std::list<Boundary<std::list>>::iterator> lines;
+  std::unordered_map<uint64_t, std::set<size_t>> starts;
   for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-    for (auto b = boundaries.begin(); b != boundaries.end(); b++) {
-      if (a == b) {
-        continue;
+    starts[point_key(a->front())].insert(lines.size());
+    lines.push_back(a);
+  }
+  // Join connected tiles. Each line absorbs the earliest line that starts
+  // where it ends until no such line remains.
+  std::vector<bool> joined(lines.size(), false);
+  for (size_t a = 0; a < lines.size(); a++) {
+    if (joined[a]) {
+      continue;
+    }
+    while (true) {
+      auto it = starts.find(point_key(lines[a]->back()));
+      if (it == starts.end()) {
+        break;
       }
-      auto ap = std::prev(a->end());
-      auto bp = b->begin();
-      if (ap->x == bp->x && ap->y == bp->y) {
-        a->insert(std::next(ap), std::next(bp), b->end());
-        boundaries.erase(b);
-        goto loop_lines;
+      auto b = it->second.begin();
+      if (b != it->second.end() && *b == a) {
+        b++;
+      }
+      if (b == it->second.end()) {
+        break;
       }
+      auto line = lines[*b];
+      joined[*b] = true;
+      it->second.erase(b);
+      lines[a]->splice(
+        lines[a]->end(),
+        *line,
+        std::next(line->begin()),
+        line->end()
+      );
+      boundaries.erase(line);
     }
   }
   // Simplify geometry.
-  for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-  loop_geometry:
-    auto ap1 = a->begin();
+  for (auto& line : boundaries) {
+    if (line.size() < 3) {
+      continue;
+    }
+    auto ap1 = line.begin();
     auto ap2 = std::next(ap1);
     auto ap3 = std::next(ap2);
-    while (ap2 != a->end()) {
+    while (ap3 != line.end()) {
       if (slope(*ap1, *ap2) == slope(*ap2, *ap3)) {
-        a->erase(ap2);
-        goto loop_geometry;
+        line.erase(ap2);
+      } else {
+        ap1 = ap2;
       }
-      ap1++;
-      ap2++;
-      ap3++;
+      ap2 = ap3++;
     }
   }
 }
 
-static void merge(
-  std::list<Point>& to,
-  std::list<Point>::iterator pos,
-  std::list<Point>& from,
-  std::list<Point>::iterator first,
-  std::list<Point>::iterator last
-) {
-  if (std::distance(first, from.end()) > std::distance(last, from.end())) {
-    to.insert(pos, first, last);
-  } else {
-    std::list<Point> temp;
-    temp.insert(temp.end(), first, from.end());
-    temp.insert(temp.end(), from.begin(), last);
-    to.insert(pos, temp.begin(), temp.end());
+// A point of a boundary being merged. The points of a boundary are linked
+// in a ring, labelled in increasing order from its first point so that
+// positions compare without walking the ring.
+struct MergeNode {
+  Point point;
+  uint64_t label;
+  uint32_t prev;
+  uint32_t next;
+  uint32_t ring;
+};
+
+struct MergeRing {
+  uint32_t head;
+  uint32_t size;
+};
+
+// The span of an axis-aligned edge, keyed by its line and direction.
+struct AxisEdge {
+  uint64_t key;
+  int32_t from;
+  int32_t to;
+};
+
+struct AxisEdgeEntry {
+  int32_t end;
+  uint32_t node;
+};
+
+// Merges boundaries exactly as comparing every pair of boundaries would,
+// joining each boundary in list order with the earliest boundary that has
+// an opposite edge along the same line, but finds those edges through an
+// index of edge spans.
+class BoundaryMerger {
+public:
+  static const uint32_t none = std::numeric_limits<uint32_t>::max();
+
+  template<typename T>
+  void add(const T& boundary) {
+    uint32_t ring = rings.size();
+    rings.push_back({none, 0});
+    for (const auto& point : boundary) {
+      uint32_t node = nodes.size();
+      uint64_t label = static_cast<uint64_t>(rings[ring].size + 1) << 32;
+      if (rings[ring].head == none) {
+        nodes.push_back({point, label, node, node, ring});
+        rings[ring].head = node;
+      } else {
+        uint32_t head = rings[ring].head;
+        uint32_t last = nodes[head].prev;
+        nodes.push_back({point, label, last, head, ring});
+        nodes[last].next = node;
+        nodes[head].prev = node;
+      }
+      rings[ring].size++;
+    }
   }
-}
 
-static void merge_bounds(
-  std::list<Boundary<std::list>>& boundaries
-) {
-  // Join connected tiles.
- loop_tiles:
-  for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-    for (auto b = boundaries.begin(); b != boundaries.end(); b++) {
-      if (a == b) {
-        continue;
+  void join() {
+    for (uint32_t ring = 0; ring < rings.size(); ring++) {
+      uint32_t node = rings[ring].head;
+      for (uint32_t i = 0; i < rings[ring].size; i++) {
+        add_edge(node);
+        node = nodes[node].next;
       }
-      auto ap1 = a->begin();
-      auto ap2 = next_wrap(*a, ap1);
-      while (ap1 != a->end()) {
-        auto bp1 = b->begin();
-        auto bp2 = next_wrap(*b, bp1);
-        while (bp1 != b->end()) {
-          if (ap1->x == ap2->x && bp1->x == bp2->x
-              && ap1->x == bp1->x) {
-            // Boundaries on the same vertical.
-            if (ap1->y < ap2->y && bp1->y > bp2->y) {
-              // Av B^
-              if (ap1->y == bp2->y && ap2->y == bp1->y) {
-                // Merge O boundaries.
-                merge(*a, ap2, *b, std::next(bp2), bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y == bp2->y && ap2->y < bp1->y) {
-                // Merge L boundaries (short A).
-                merge(*a, ap2, *b, std::next(bp2), std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y < bp2->y && ap2->y == bp1->y) {
-                // Merge L boundaries (short B).
-                merge(*a, ap2, *b, bp2, bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y > bp2->y && ap2->y == bp1->y) {
-                // Merge J boundaries (short A).
-                merge(*a, ap2, *b, bp2, bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y == bp2->y && ap2->y > bp1->y) {
-                // Merge J boundaries (short B).
-                merge(*a, ap2, *b, std::next(bp2), std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y > bp2->y && ap2->y < bp1->y) {
-                // Merge T boundaries (short A).
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y < bp2->y && ap2->y > bp1->y) {
-                // Merge T boundaries (short B).
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y < bp2->y && ap2->y < bp1->y
-                         && ap2->y > bp2->y) {
-                // Merge S boundaries.
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->y > bp2->y && ap2->y > bp1->y
-                         && ap1->y < bp1->y) {
-                // Merge Z boundaries.
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              }
+    }
+    // Edges only ever shrink along their own line, so a boundary without
+    // partners never gains one and each boundary is joined once, in order.
+    for (uint32_t a = 0; a < rings.size(); a++) {
+      std::priority_queue<
+        uint32_t,
+        std::vector<uint32_t>,
+        std::greater<uint32_t>
+      > partners;
+      auto find_partners = [&](uint32_t node) {
+        AxisEdge edge;
+        if (axis_edge(node, edge) && forward(edge)) {
+          visit_opposite(edge, [&](uint32_t other) {
+            if (nodes[other].ring != a) {
+              partners.push(nodes[other].ring);
             }
-          } else if (ap1->y == ap2->y && bp1->y == bp2->y
-                     && ap1->y == bp1->y) {
-            // Boundaries on the same horizontal.
-            if (ap1->x < ap2->x && bp1->x > bp2->x) {
-              // A> B<
-              if (ap1->x == bp2->x && ap2->x == bp1->x) {
-                // Merge O boundaries.
-                merge(*a, ap2, *b, std::next(bp2), bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x == bp2->x && ap2->x < bp1->x) {
-                // Merge L boundaries (short A).
-                merge(*a, ap2, *b, std::next(bp2), std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x < bp2->x && ap2->x == bp1->x) {
-                // Merge L boundaries (short B).
-                merge(*a, ap2, *b, bp2, bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x > bp2->x && ap2->x == bp1->x) {
-                // Merge J boundaries (short A).
-                merge(*a, ap2, *b, bp2, bp1);
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x == bp2->x && ap2->x > bp1->x) {
-                // Merge J boundaries (short B).
-                merge(*a, ap2, *b, std::next(bp2), std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x > bp2->x && ap2->x < bp1->x) {
-                // Merge T boundaries (short A).
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x < bp2->x && ap2->x > bp1->x) {
-                // Merge T boundaries (short B).
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
-              } else if (ap1->x < bp2->x && ap2->x < bp1->x
-                         && ap2->x > bp2->x) {
-                // Merge S boundaries.
-                boundaries.erase(b);
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                goto loop_tiles;
-              } else if (ap1->x > bp2->x && ap2->x > bp1->x
-                         && ap1->x < bp1->x) {
-                // Merge Z boundaries.
-                merge(*a, ap2, *b, bp2, std::next(bp1));
-                boundaries.erase(b);
-                goto loop_tiles;
+          });
+        }
+      };
+      uint32_t node = rings[a].head;
+      for (uint32_t i = 0; i < rings[a].size; i++) {
+        find_partners(node);
+        node = nodes[node].next;
+      }
+      while (!partners.empty()) {
+        uint32_t b = partners.top();
+        partners.pop();
+        // Find the first edge of A along an edge of B, then the first edge
+        // of B along that.
+        uint32_t ap1 = none;
+        uint32_t bp1 = rings[b].head;
+        for (uint32_t i = 0; i < rings[b].size; i++) {
+          AxisEdge edge;
+          if (axis_edge(bp1, edge) && !forward(edge)) {
+            visit_opposite(edge, [&](uint32_t other) {
+              if (nodes[other].ring == a
+                  && (ap1 == none
+                      || nodes[other].label < nodes[ap1].label)) {
+                ap1 = other;
               }
+            });
+          }
+          bp1 = nodes[bp1].next;
+        }
+        if (ap1 == none) {
+          continue;
+        }
+        while (!opposite(ap1, bp1)) {
+          bp1 = nodes[bp1].next;
+        }
+        uint32_t first, count;
+        merge(a, ap1, b, bp1, first, count);
+        find_partners(ap1);
+        for (uint32_t i = 0; i < count; i++) {
+          find_partners(first + i);
+        }
+      }
+    }
+  }
+
+  void reduce() {
+    // Merge overlapping lines.
+    for (uint32_t ring = 0; ring < rings.size(); ring++) {
+      remove_spikes(ring);
+    }
+    // If there are residual overlapping lines, they represent bleed in to
+    // areas that should be separate boundaries.
+    for (uint32_t ring = 0; ring < rings.size(); ring++) {
+      uint32_t node = rings[ring].head;
+      for (uint32_t i = 0; i < rings[ring].size; i++) {
+        add_half_edge(node);
+        node = nodes[node].next;
+      }
+    }
+    for (uint32_t ring = 0; ring < rings.size(); ring++) {
+      uint32_t ap1 = rings[ring].head;
+      while (rings[ring].size && ap1 != nodes[rings[ring].head].prev) {
+        uint32_t ap2 = nodes[ap1].next;
+        uint32_t ap3 = none;
+        auto reverse = half_edges.find({
+          point_key(nodes[ap2].point),
+          point_key(nodes[ap1].point),
+        });
+        if (reverse != half_edges.end()) {
+          for (auto node : reverse->second) {
+            if (nodes[node].ring == ring
+                && nodes[node].label > nodes[ap2].label
+                && (ap3 == none || nodes[node].label < nodes[ap3].label)) {
+              ap3 = node;
             }
           }
-          bp1++;
-          bp2 = next_wrap(*b, bp2);
         }
-        ap1++;
-        ap2 = next_wrap(*a, ap2);
+        if (ap3 == none) {
+          ap1 = ap2;
+          continue;
+        }
+        uint32_t split_ring = split(ring, ap1, ap3);
+        remove_spikes_at(ring, ap1);
+        remove_spikes_at(
+          split_ring,
+          nodes[rings[split_ring].head].prev
+        );
+        // Earlier points have no overlapping lines left, so carry on from
+        // the first point still in the ring.
+        while (rings[ring].size && nodes[ap1].ring != ring) {
+          ap1 = nodes[ap1].ring == none
+            ? nodes[ap1].next
+            : rings[ring].head;
+        }
+      }
+    }
+  }
+
+  void simplify() {
+    for (uint32_t ring = 0; ring < rings.size(); ring++) {
+      uint32_t ap1 = rings[ring].head;
+      while (rings[ring].size) {
+        if (rings[ring].size < 3) {
+          clear(ring);
+          break;
+        }
+        uint32_t ap2 = nodes[ap1].next;
+        uint32_t ap3 = nodes[ap2].next;
+        if (slope(nodes[ap1].point, nodes[ap2].point)
+            == slope(nodes[ap2].point, nodes[ap3].point)) {
+          uint32_t back = ap1 == rings[ring].head ? ap1 : nodes[ap1].prev;
+          erase(ring, ap2);
+          ap1 = nodes[back].ring == ring ? back : rings[ring].head;
+          continue;
+        }
+        if (ap2 == rings[ring].head) {
+          break;
+        }
+        ap1 = ap2;
+      }
+    }
+  }
+
+  std::list<Boundary<std::list>> boundaries() const {
+    // Remove empty paths.
+    std::list<Boundary<std::list>> boundaries;
+    for (const auto& ring : rings) {
+      if (ring.size) {
+        boundaries.emplace_back();
+        uint32_t node = ring.head;
+        for (uint32_t i = 0; i < ring.size; i++) {
+          boundaries.back().push_back(nodes[node].point);
+          node = nodes[node].next;
+        }
+      }
+    }
+    return boundaries;
+  }
+
+private:
+  static bool forward(const AxisEdge& edge) {
+    return edge.key & (1ull << 32);
+  }
+
+  bool axis_edge(uint32_t node, AxisEdge& edge) const {
+    const auto& a = nodes[node].point;
+    const auto& b = nodes[nodes[node].next].point;
+    uint64_t key;
+    if (a.x == b.x && a.y != b.y) {
+      key = (1ull << 33) | (static_cast<uint64_t>(b.y > a.y) << 32);
+      edge = {key | static_cast<uint32_t>(a.x), a.y, b.y};
+    } else if (a.y == b.y && a.x != b.x) {
+      key = static_cast<uint64_t>(b.x > a.x) << 32;
+      edge = {key | static_cast<uint32_t>(a.y), a.x, b.x};
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void add_edge(uint32_t node) {
+    AxisEdge edge;
+    if (axis_edge(node, edge)) {
+      edges[edge.key].insert({
+        std::min(edge.from, edge.to),
+        {std::max(edge.from, edge.to), node},
+      });
+    }
+  }
+
+  void remove_edge(uint32_t node) {
+    AxisEdge edge;
+    if (axis_edge(node, edge)) {
+      auto& line = edges[edge.key];
+      auto range = line.equal_range(std::min(edge.from, edge.to));
+      for (auto it = range.first; it != range.second; it++) {
+        if (it->second.node == node) {
+          line.erase(it);
+          break;
+        }
+      }
+    }
+  }
+
+  // Visits edges on the same line in the other direction that overlap.
+  template<typename F>
+  void visit_opposite(const AxisEdge& edge, F visit) const {
+    auto line = edges.find(edge.key ^ (1ull << 32));
+    if (line == edges.end()) {
+      return;
+    }
+    int32_t lo = std::min(edge.from, edge.to);
+    int32_t hi = std::max(edge.from, edge.to);
+    auto it = line->second.upper_bound(lo);
+    while (it != line->second.begin() && std::prev(it)->second.end > lo) {
+      it--;
+    }
+    for (; it != line->second.end() && it->first < hi; it++) {
+      if (it->second.end > lo) {
+        visit(it->second.node);
       }
     }
   }
-  // Reduce boundaries.
- loop_reduce:
-  for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-  loop_overlap:
-    // Merge overlapping lines.
-    auto ap1 = a->begin();
-    auto ap2 = next_wrap(*a, ap1);
-    auto ap3 = next_wrap(*a, ap2);
-    while (ap1 != a->end()) {
-      if (ap1->x == ap3->x && ap1->y == ap3->y) {
-        a->erase(ap1);
-        a->erase(ap2);
-        goto loop_overlap;
-      }
-      ap1++;
-      ap2 = next_wrap(*a, ap2);
-      ap3 = next_wrap(*a, ap3);
+
+  bool opposite(uint32_t a, uint32_t b) const {
+    AxisEdge ea, eb;
+    return axis_edge(a, ea) && axis_edge(b, eb)
+      && (ea.key ^ (1ull << 32)) == eb.key
+      && std::min(ea.from, ea.to) < std::max(eb.from, eb.to)
+      && std::min(eb.from, eb.to) < std::max(ea.from, ea.to);
+  }
+
+  // Inserts the points of B that bridge its edge from BP1 into A after AP1.
+  void merge(
+    uint32_t a,
+    uint32_t ap1,
+    uint32_t b,
+    uint32_t bp1,
+    uint32_t& first,
+    uint32_t& count
+  ) {
+    uint32_t bp2 = nodes[bp1].next;
+    AxisEdge ea, eb;
+    axis_edge(ap1, ea);
+    axis_edge(bp1, eb);
+    uint32_t from, to;
+    if (ea.from == eb.to && ea.to == eb.from) {
+      // Merge O boundaries.
+      from = nodes[bp2].next;
+      to = bp1;
+    } else if (ea.from == eb.to) {
+      // Merge L (short A) and J (short B) boundaries.
+      from = nodes[bp2].next;
+      to = nodes[bp1].next;
+    } else if (ea.to == eb.from) {
+      // Merge L (short B) and J (short A) boundaries.
+      from = bp2;
+      to = bp1;
+    } else {
+      // Merge T, S and Z boundaries.
+      from = bp2;
+      to = bp2;
+    }
+    std::vector<Point> points;
+    uint32_t node = from;
+    do {
+      points.push_back(nodes[node].point);
+      node = nodes[node].next;
+    } while (node != to);
+    remove_edge(ap1);
+    node = rings[b].head;
+    for (uint32_t i = 0; i < rings[b].size; i++) {
+      remove_edge(node);
+      nodes[node].ring = none;
+      node = nodes[node].next;
+    }
+    rings[b] = {none, 0};
+    insert(a, ap1, points);
+    first = nodes.size() - points.size();
+    count = points.size();
+    add_edge(ap1);
+    for (uint32_t i = 0; i < count; i++) {
+      add_edge(first + i);
+    }
+  }
+
+  void insert(uint32_t ring, uint32_t after, const std::vector<Point>& points) {
+    uint32_t before = nodes[after].next;
+    bool front = before == rings[ring].head;
+    uint64_t lo = front ? 0 : nodes[after].label;
+    uint64_t step = (nodes[before].label - lo) / (points.size() + 1);
+    uint32_t prev = after;
+    for (size_t i = 0; i < points.size(); i++) {
+      uint32_t node = nodes.size();
+      nodes.push_back({points[i], lo + step * (i + 1), prev, before, ring});
+      nodes[prev].next = node;
+      prev = node;
+    }
+    nodes[before].prev = prev;
+    if (front) {
+      rings[ring].head = nodes[after].next;
+    }
+    rings[ring].size += points.size();
+    if (step == 0) {
+      uint64_t spacing = std::numeric_limits<uint64_t>::max()
+        / (rings[ring].size + 1);
+      uint32_t node = rings[ring].head;
+      for (uint32_t i = 0; i < rings[ring].size; i++) {
+        nodes[node].label = spacing * (i + 1);
+        node = nodes[node].next;
+      }
+    }
+  }
+
+  void erase(uint32_t ring, uint32_t node) {
+    auto& n = nodes[node];
+    nodes[n.prev].next = n.next;
+    nodes[n.next].prev = n.prev;
+    if (rings[ring].head == node) {
+      rings[ring].head = n.next;
+    }
+    n.ring = none;
+    if (!--rings[ring].size) {
+      rings[ring].head = none;
+    }
+  }
+
+  void clear(uint32_t ring) {
+    while (rings[ring].size) {
+      erase(ring, rings[ring].head);
     }
   }
-  for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-    // If there are residual overlapping lines, they represent bleed in to
-    // areas that should be separate boundaries.
-    auto ap1 = a->begin();
-    auto ap2 = next_wrap(*a, ap1);
-    while (ap1 != a->end()) {
-      auto ap3 = next_wrap(*a, ap2);
-      auto ap4 = next_wrap(*a, ap3);
-      while (ap3 != a->end()) {
-        if (ap1->x == ap4->x && ap1->y == ap4->y
-            && ap2->x == ap3->x && ap2->y == ap3->y) {
-          Boundary<std::list> new_boundary;
-          new_boundary.insert(new_boundary.end(), ap1, ap4);
-          a->erase(ap2, ap3);
-          boundaries.push_back(new_boundary);
-          goto loop_reduce;
+
+  void add_half_edge(uint32_t node) {
+    half_edges[{
+      point_key(nodes[node].point),
+      point_key(nodes[nodes[node].next].point),
+    }].push_back(node);
+  }
+
+  // Moves the points from AP1 to AP3 into a new ring, leaving the line from
+  // AP1 to AP3 in the old one.
+  uint32_t split(uint32_t ring, uint32_t ap1, uint32_t ap3) {
+    uint32_t split_ring = rings.size();
+    rings.push_back({none, 0});
+    uint32_t ap2 = nodes[ap1].next;
+    uint32_t last = nodes[ap3].prev;
+    uint32_t first_copy = nodes.size();
+    uint32_t last_copy = first_copy + 1;
+    nodes.push_back(
+      {nodes[ap1].point, nodes[ap1].label, last_copy, ap2, split_ring}
+    );
+    nodes.push_back(
+      {nodes[ap3].point, nodes[ap3].label, last, first_copy, split_ring}
+    );
+    uint32_t count = 0;
+    for (uint32_t node = ap2; node != ap3; node = nodes[node].next) {
+      nodes[node].ring = split_ring;
+      count++;
+    }
+    nodes[ap2].prev = first_copy;
+    nodes[last].next = last_copy;
+    nodes[ap1].next = ap3;
+    nodes[ap3].prev = ap1;
+    rings[ring].size -= count;
+    rings[split_ring] = {first_copy, count + 2};
+    add_half_edge(first_copy);
+    add_half_edge(last_copy);
+    return split_ring;
+  }
+
+  // Removes lines that double back on themselves, such as P Q P.
+  void remove_spikes(uint32_t ring) {
+    uint32_t ap1 = rings[ring].head;
+    while (rings[ring].size) {
+      if (rings[ring].size < 3) {
+        clear(ring);
+        break;
+      }
+      uint32_t ap2 = nodes[ap1].next;
+      uint32_t ap3 = nodes[ap2].next;
+      if (point_key(nodes[ap1].point) == point_key(nodes[ap3].point)) {
+        // Points before the two before AP1 are unaffected.
+        uint32_t back = ap1;
+        for (int i = 0; i < 2 && back != rings[ring].head; i++) {
+          back = nodes[back].prev;
         }
-        ap3++;
-        ap4 = next_wrap(*a, ap4);
+        erase(ring, ap1);
+        erase(ring, ap2);
+        ap1 = rings[ring].size && nodes[back].ring == ring
+          ? back
+          : rings[ring].head;
+        continue;
+      }
+      if (ap2 == rings[ring].head) {
+        break;
       }
-      ap1++;
-      ap2 = next_wrap(*a, ap2);
+      ap1 = ap2;
     }
   }
-  // Simplify geometry.
-  for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
-  loop_geometry:
-    auto ap1 = a->begin();
-    auto ap2 = next_wrap(*a, ap1);
-    auto ap3 = next_wrap(*a, ap2);
-    while (ap1 != a->end()) {
-      if (slope(*ap1, *ap2) == slope(*ap2, *ap3)) {
-        a->erase(ap2);
-        goto loop_geometry;
+
+  // Removes spikes around the line from AP1, the only place they can be.
+  void remove_spikes_at(uint32_t ring, uint32_t ap1) {
+    while (rings[ring].size) {
+      if (rings[ring].size < 3) {
+        clear(ring);
+        break;
+      }
+      uint32_t ap0 = nodes[ap1].prev;
+      uint32_t ap2 = nodes[ap1].next;
+      uint32_t ap3 = nodes[ap2].next;
+      bool before = point_key(nodes[ap0].point)
+        == point_key(nodes[ap2].point);
+      bool after = point_key(nodes[ap1].point)
+        == point_key(nodes[ap3].point);
+      if (before && after) {
+        before = nodes[ap0].label < nodes[ap1].label;
+        after = !before;
+      }
+      if (before) {
+        uint32_t back = nodes[ap0].prev;
+        erase(ring, ap0);
+        erase(ring, ap1);
+        ap1 = back;
+      } else if (after) {
+        erase(ring, ap1);
+        erase(ring, ap2);
+        ap1 = ap0;
+      } else {
+        break;
       }
-      ap1++;
-      ap2 = next_wrap(*a, ap2);
-      ap3 = next_wrap(*a, ap3);
     }
   }
-  // Remove empty paths.
-  auto it = boundaries.begin();
-  while (it != boundaries.end()) {
-    if (it->size() == 0) {
-      it = boundaries.erase(it);
-    } else {
-      it++;
-    }
+
+  std::vector<MergeNode> nodes;
+  std::vector<MergeRing> rings;
+  std::unordered_map<uint64_t, std::multimap<int32_t, AxisEdgeEntry>> edges;
+  std::unordered_map<
+    HalfEdgeKey,
+    std::vector<uint32_t>,
+    HalfEdgeKeyHash
+  > half_edges;
+};
+
+static void merge_bounds(
+  std::list<Boundary<std::list>>& boundaries,
+  const std::vector<Boundary<InlineArray>>& shapes
+) {
+  BoundaryMerger merger;
+  for (const auto& boundary : boundaries) {
+    merger.add(boundary);
   }
+  for (const auto& shape : shapes) {
+    merger.add(shape);
+  }
+  // Join connected tiles.
+  merger.join();
+  // Reduce boundaries.
+  merger.reduce();
+  // Simplify geometry.
+  merger.simplify();
+  boundaries = merger.boundaries();
 }
 
 static std::list<Boundary<std::list>> points_from_bounds(
@@ -1237,9 +2300,9 @@ static std::list<Boundary<std::list>> points_from_bounds(
   world_w -= world_x;
   world_h -= world_y;
   // Create boundary around maps.
-  std::list<Boundary<std::list>> boundaries;
+  std::vector<Boundary<InlineArray>> shapes;
   for (const auto& map : maps) {
-    Boundary<std::list> boundary;
+    Boundary<InlineArray> boundary;
     boundary.push_back({
       .x = (map.x) << 4,
       .y = (map.y) << 4,
@@ -1256,31 +2319,24 @@ static std::list<Boundary<std::list>> points_from_bounds(
       .x = (map.x + map.w) << 4,
       .y = (map.y) << 4,
     });
-    boundaries.push_back(boundary);
+    shapes.push_back(boundary);
   }
-  merge_bounds(boundaries);
+  std::list<Boundary<std::list>> boundaries;
+  merge_bounds(boundaries, shapes);
   // Collect boundary lines for each tile.
+  shapes.clear();
   for (int i = 0; i < maps.size(); i++) {
     const auto& map = maps[i];
-    for (int y = 0; y < map.h; y++) {
-      for (int x = 0; x < map.w; x++) {
-        auto tile = bounds[i].tiles[x + y * map.w];
-        if (tile && !((tile - 1) & BoundsTile::OneWay)) {
-          auto geo = geometry.at(tile - 1);
-          if (geo.size()) {
-            Boundary<std::list> points;
-            for (auto& point : geo) {
-              point.x += (map.x + x) << 4;
-              point.y += (map.y + y) << 4;
-              points.push_back(point);
-            }
-            boundaries.push_back(points);
-          }
-        }
-      }
-    }
+    ultra::sdk::seed_tile_boundaries(
+      bounds[i].tiles.data(),
+      map.w,
+      map.h,
+      map.x,
+      map.y,
+      shapes
+    );
   }
-  merge_bounds(boundaries);
+  merge_bounds(boundaries, shapes);
   // Remove the outer boundary.
   for (auto a = boundaries.begin(); a != boundaries.end(); a++) {
     if (a->size() == 4) {
@@ -1307,22 +2363,22 @@ static std::list<Boundary<std::list>> points_from_bounds(
   }
   // One-way boundaries don't connect to the normal map geometry.
   // Collect boundary lines for each one-way tile.
+  constexpr auto one_way = ultra::sdk::BoundsTile::OneWay;
   std::list<Boundary<std::list>> one_way_boundaries;
   for (int i = 0; i < maps.size(); i++) {
     const auto& map = maps[i];
     for (int y = 0; y < map.h; y++) {
       for (int x = 0; x < map.w; x++) {
         auto tile = bounds[i].tiles[x + y * map.w];
-        if (tile && (tile - 1) & BoundsTile::OneWay) {
-          auto geo = geometry.at(tile - 1);
-          if (geo.size()) {
-            Boundary<std::list> points;
-            points.flags = BoundsTile::OneWay;
-            for (auto& point : geo) {
-              point.x += (map.x + x) << 4;
-              point.y += (map.y + y) << 4;
-              points.push_back(point);
-            }
+        if (tile && ultra::sdk::has_bounds_bits(tile - 1, one_way)) {
+          const auto& shape = ultra::sdk::get_bounds_shape(tile - 1);
+          if (shape.size) {
+            auto points = ultra::sdk::place_bounds_shape<std::list>(
+              shape,
+              map.x + x,
+              map.y + y
+            );
+            points.flags = ultra::sdk::bounds_code(one_way);
             one_way_boundaries.push_back(points);
           }
         }
@@ -1339,385 +2395,679 @@ static std::list<Boundary<std::list>> points_from_bounds(
   return boundaries;
 }
 
-static void print_usage(const char* self, std::ostream& out) {
-  out << "Usage: " << self << " [-h] [-c config.yaml] <in.world> <out.bin>"
-      << std::endl;
+// Collision classes in collision grids.
+enum TileCollision {
+  NoCollision     = 0,
+  SolidCollision  = 1,
+  OneWayCollision = 2,
+  SlopeCollision  = 3,
+};
+
+static uint8_t get_tile_collision(uint16_t tile) {
+  using ultra::sdk::BoundsTile;
+  if (tile == 0) {
+    return NoCollision;
+  }
+  // Throws for codes without a shape.
+  const auto& shape = ultra::sdk::get_bounds_shape(tile - 1);
+  if (!shape.size) {
+    return NoCollision;
+  }
+  if (ultra::sdk::has_bounds_bits(tile - 1, BoundsTile::OneWay)) {
+    return OneWayCollision;
+  }
+  if (tile - 1 == ultra::sdk::bounds_code(BoundsTile::Solid)) {
+    return SolidCollision;
+  }
+  // Slopes and half tiles, whose shape is only in the boundaries.
+  return SlopeCollision;
 }
 
-int main(int argc, const char* argv[]) {
-  // Check for help option.
-  for (int i = 0; i < argc; i++) {
-    std::string arg(argv[i]);
-    if (arg == "-h" || arg == "--help") {
-      print_usage(argv[0], std::cout);
-      return 0;
-    }
+// Classify the bounds tiles of each map, row by row. With one bit a tile is
+// set if it is fully solid, and with two bits it holds its class.
+// Tiles are packed from the lowest bits of each byte.
+static std::vector<CollisionGrid> collision_grids(
+  const std::vector<Map>& maps,
+  const std::vector<Layer>& bounds,
+  unsigned bits
+) {
+  if (bits != 1 && bits != 2) {
+    throw std::runtime_error("Collision grids must use 1 or 2 bits per tile");
   }
-  if (argc != 3 && argc != 5) {
-    print_usage(argv[0], std::cerr);
-    return 1;
+  std::vector<CollisionGrid> grids(maps.size());
+  for (size_t i = 0; i < maps.size(); i++) {
+    const auto& map = maps[i];
+    auto& grid = grids[i];
+    size_t count = map.w * map.h;
+    grid.bits = bits;
+    grid.data.resize((count * bits + 7) / 8);
+    for (size_t j = 0; j < count; j++) {
+      uint8_t value = get_tile_collision(bounds[i].tiles[j]);
+      if (bits == 1) {
+        value = value == SolidCollision;
+      }
+      grid.data[j * bits / 8] |= value << (j * bits % 8);
+    }
   }
-  // Check for entity configuration file.
-  YAML::Node config;
-  int json_arg_idx = 1;
-  int out_arg_idx = 2;
-  if (argc == 5) {
-    json_arg_idx = 3;
-    out_arg_idx = 4;
-    std::string arg(argv[1]);
-    if (arg == "-c") {
-      config = YAML::LoadFile(argv[2]);
-    } else {print_usage(argv[0], std::cerr);
-      return 1;
+  return grids;
+}
+
+// Get the solid span of each pixel column of a tile shape, from the highest
+// to the lowest point of the shape within the column. Columns the shape
+// doesn't reach have a floor of 16 and a ceiling of 0.
+static void get_column_heights(
+  const ultra::sdk::BoundsShape& shape,
+  uint8_t* floor,
+  uint8_t* ceiling
+) {
+  for (int x = 0; x < 16; x++) {
+    double top = std::numeric_limits<double>::infinity();
+    double bottom = -top;
+    for (auto a = shape.begin(); a != shape.end(); a++) {
+      auto b = std::next(a);
+      if (b == shape.end()) {
+        b = shape.begin();
+      }
+      // Shapes are straight between points, so their extent within the
+      // column is reached on its edges.
+      for (int edge = x; edge <= x + 1; edge++) {
+        if (edge < std::min(a->x, b->x) || edge > std::max(a->x, b->x)) {
+          continue;
+        }
+        double y0 = a->y;
+        double y1 = b->y;
+        if (a->x != b->x) {
+          y0 = y1 = a->y
+            + static_cast<double>(b->y - a->y) * (edge - a->x) / (b->x - a->x);
+        }
+        top = std::min({top, y0, y1});
+        bottom = std::max({bottom, y0, y1});
+      }
+    }
+    if (top > bottom) {
+      floor[x] = 16;
+      ceiling[x] = 0;
+    } else {
+      floor[x] = std::floor(top);
+      ceiling[x] = std::ceil(bottom);
     }
   }
-  std::string path(argv[json_arg_idx]);
-  auto prefix = path.substr(0, path.rfind("/"));
-  if (prefix == path) {
-    prefix = ".";
+}
+
+// Tabulate the column heights of every tile shape, empty first, and index
+// the bounds tiles of each map in the table, a byte to a tile.
+static HeightTables height_tables(
+  const std::vector<Map>& maps,
+  const std::vector<Layer>& bounds
+) {
+  HeightTables heights;
+  std::array<uint8_t, ultra::sdk::bounds_tile_count> indexes = {};
+  for (size_t code = 0; code < ultra::sdk::bounds_tile_count; code++) {
+    const auto& shape = ultra::sdk::bounds_shapes[code];
+    if (!shape.defined) {
+      continue;
+    }
+    indexes[code] = heights.table.size() / 32;
+    heights.table.resize(heights.table.size() + 32);
+    auto entry = heights.table.end() - 32;
+    get_column_heights(shape, &*entry, &*entry + 16);
   }
-  prefix += "/";
-  auto world = load_json(argv[json_arg_idx]);
-  // Parse maps.
-  std::vector<Map> maps;
-  std::vector<Layer> bounds;
-  for (int i = 0; i < world["maps"].size(); i++) {
-    // Open map file.
-    auto map_file_path = prefix + world["maps"][i]["fileName"].asString();
-    rapidxml::xml_document<> map_doc;
-    auto map_file = load_xml(map_file_path.c_str(), map_doc);
-    // Get width and height from map attributes.
-    uint16_t w, h;
-    for (auto attr = map_doc.first_node()->first_attribute();
-         attr != nullptr;
-         attr = attr->next_attribute()) {
-      std::string attr_name(attr->name());
-      if (attr_name == "width") {
-        w = static_cast<uint16_t>(std::atoi(attr->value()));
-      } else if (attr_name == "height") {
-        h = static_cast<uint16_t>(std::atoi(attr->value()));
+  for (size_t i = 0; i < maps.size(); i++) {
+    auto& grid = heights.maps.emplace_back(bounds[i].tiles.size());
+    for (size_t j = 0; j < grid.size(); j++) {
+      auto tile = bounds[i].tiles[j];
+      if (tile) {
+        // Reject unknown tiles.
+        ultra::sdk::get_bounds_shape(tile - 1);
+        grid[j] = indexes[tile - 1];
       }
     }
-    std::vector<uint32_t> properties;
-    std::vector<Layer> layers;
-    std::vector<Tileset> tilesets;
-    std::vector<Entity> entities;
-    // Iterate nodes for layers and tilesets.
-    size_t map_tileset_index = 0;
-    size_t entity_tileset_index = 0;
-    int entities_layer_index = -1;
-    uint8_t layer_index = 0;
-    for (auto map_node = map_doc.first_node()->first_node();
-         map_node != nullptr;
-         map_node = map_node->next_sibling()) {
-      std::string node_name(map_node->name());
-      if (node_name == "properties") {
-        for (auto properties_node = map_node->first_node();
-             properties_node != nullptr;
-             properties_node = properties_node->next_sibling()) {
-          std::string node_name(properties_node->name());
-          if (node_name == "property") {
-            std::uint32_t name;
-            std::string type = "string";
-            std::string value;
-            for (auto attr = properties_node->first_attribute();
-                 attr != nullptr;
-                 attr = attr->next_attribute()) {
-              std::string attr_name(attr->name());
-              std::string attr_value(attr->value());
-              if (attr_name == "name") {
-                name = ultra::sdk::util::crc32(attr_value.c_str());
-              } else if (attr_name == "type") {
-                type = attr_value;
-              } else if (attr_name == "value") {
-                value = attr_value;
-              }
+  }
+  return heights;
+}
+
+static Map read_map(
+  const char* path,
+  const std::string& prefix,
+  int16_t x,
+  int16_t y,
+  std::vector<Layer>& bounds
+) {
+  rapidxml::xml_document<> map_doc;
+  auto map_file = load_xml(path, map_doc);
+  // Get width and height from map attributes.
+  uint16_t w, h;
+  for (auto attr = map_doc.first_node()->first_attribute();
+       attr != nullptr;
+       attr = attr->next_attribute()) {
+    std::string attr_name(attr->name());
+    if (attr_name == "width") {
+      w = static_cast<uint16_t>(std::atoi(attr->value()));
+    } else if (attr_name == "height") {
+      h = static_cast<uint16_t>(std::atoi(attr->value()));
+    }
+  }
+  std::vector<uint32_t> properties;
+  std::vector<Layer> layers;
+  std::vector<Tileset> tilesets;
+  std::vector<Entity> entities;
+  ultra::sdk::util::HashMap<std::string> names;
+  // Iterate nodes for layers and tilesets.
+  size_t map_tileset_index = 0;
+  size_t entity_tileset_index = 0;
+  int entities_layer_index = -1;
+  uint8_t layer_index = 0;
+  for (auto map_node = map_doc.first_node()->first_node();
+       map_node != nullptr;
+       map_node = map_node->next_sibling()) {
+    std::string node_name(map_node->name());
+    if (node_name == "properties") {
+      for (auto properties_node = map_node->first_node();
+           properties_node != nullptr;
+           properties_node = properties_node->next_sibling()) {
+        std::string node_name(properties_node->name());
+        if (node_name == "property") {
+          std::uint32_t name;
+          std::string type = "string";
+          std::string value;
+          for (auto attr = properties_node->first_attribute();
+               attr != nullptr;
+               attr = attr->next_attribute()) {
+            std::string attr_name(attr->name());
+            std::string attr_value(attr->value());
+            if (attr_name == "name") {
+              name = ultra::sdk::util::crc32(attr_value.c_str(), names);
+            } else if (attr_name == "type") {
+              type = attr_value;
+            } else if (attr_name == "value") {
+              value = attr_value;
             }
-            uint32_t int_value;
-            if (type == "int") {
-              int_value = static_cast<uint16_t>(std::atoi(value.c_str()));
-            } else if (type == "bool") {
-              if (value == "true") {
-                int_value = 1;
-              } else {
-                int_value = 0;
-              }
-            } else if (type == "string") {
-              int_value = ultra::sdk::util::crc32(value.c_str());
+          }
+          uint32_t int_value;
+          if (type == "int") {
+            int_value = static_cast<uint16_t>(std::atoi(value.c_str()));
+          } else if (type == "bool") {
+            if (value == "true") {
+              int_value = 1;
+            } else {
+              int_value = 0;
             }
-            properties.push_back(name);
-            properties.push_back(int_value);
+          } else if (type == "string") {
+            int_value = ultra::sdk::util::crc32(value.c_str(), names);
           }
+          properties.push_back(name);
+          properties.push_back(int_value);
+        }
+      }
+    } else if (node_name == "tileset") {
+      Tileset tileset = {
+        .map_index = -1,
+        .entity_index = -1,
+      };
+      // Parse attributes for the first gid and source.
+      std::string tileset_source;
+      for (auto attr = map_node->first_attribute();
+           attr != nullptr;
+           attr = attr->next_attribute()) {
+        std::string attr_name(attr->name());
+        if (attr_name == "firstgid") {
+          tileset.first_gid = static_cast<uint16_t>(
+            std::atoi(attr->value())
+          );
+        } else if (attr_name == "source") {
+          tileset_source = prefix + attr->value();
         }
-      } else if (node_name == "tileset") {
-        Tileset tileset = {
-          .map_index = -1,
-          .entity_index = -1,
-        };
-        // Parse attributes for the first gid and source.
-        std::string tileset_source;
-        for (auto attr = map_node->first_attribute();
-             attr != nullptr;
-             attr = attr->next_attribute()) {
-          std::string attr_name(attr->name());
-          if (attr_name == "firstgid") {
-            tileset.first_gid = static_cast<uint16_t>(
-              std::atoi(attr->value())
+      }
+      // Read the tileset document.
+      tileset.path = tileset_source;
+      tileset.tileset = ultra::sdk::read_shared_tileset(
+        tileset_source.c_str()
+      );
+      tilesets.push_back(tileset);
+    } else if (node_name == "layer") {
+      // Parse attributes.
+      Layer layer = {
+        .type = Layer::Type::Image,
+        .parallax = {
+          .x = {1, 1},
+          .y = {1, 1},
+        },
+      };
+      for (auto attr = map_node->first_attribute();
+           attr != nullptr;
+           attr = attr->next_attribute()) {
+        std::string attr_name(attr->name());
+        if (attr_name == "name") {
+          layer.name = ultra::sdk::util::crc32(attr->value(), names);
+        } else if (attr_name == "parallaxx") {
+          layer.parallax.x = double_to_fraction(std::atof(attr->value()));
+        } else if (attr_name == "parallaxy") {
+          layer.parallax.y = double_to_fraction(std::atof(attr->value()));
+        }
+      }
+      // Get the layer tile data.
+      layer.tiles = std::vector<uint16_t>(w * h);
+      for (auto layer_node = map_node->first_node();
+           layer_node != nullptr;
+           layer_node = layer_node->next_sibling()) {
+        std::string node_name(layer_node->name());
+        if (node_name == "data") {
+          std::string data(layer_node->value());
+          size_t count = 0;
+          size_t start = 0;
+          size_t next = 0;
+          bool is_first_tile = true;
+          while (next != std::string::npos) {
+            next = data.find(",", start);
+            uint16_t tile = std::atoi(
+              data.substr(start, next - start).c_str()
             );
-          } else if (attr_name == "source") {
-            tileset_source = prefix + attr->value();
+            if (tile) {
+              // Adjust tile value so its first nybble is the tileset index.
+              bool found = false;
+              for (int i = tilesets.size() - 1; i >= 0; i--) {
+                if (tile >= tilesets[i].first_gid) {
+                  int index;
+                  if (tilesets[i].tileset->bounds) {
+                    if (!is_first_tile
+                        && layer.type != Layer::Type::Bounds) {
+                      throw std::runtime_error(
+                        "Image layer contains bounds tiles"
+                      );
+                    }
+                    layer.type = Layer::Type::Bounds;
+                    index = 0;
+                  } else {
+                    if (layer.type == Layer::Type::Bounds) {
+                      throw std::runtime_error(
+                        "Bounds layer contains image tiles"
+                      );
+                    }
+                    if (tilesets[i].map_index == -1) {
+                      tilesets[i].map_index = map_tileset_index++;
+                    }
+                    index = tilesets[i].map_index;
+                  }
+                  tile = (index << 12) | (tile - tilesets[i].first_gid + 1);
+                  found = true;
+                  break;
+                }
+              }
+              if (!found) {
+                throw std::runtime_error("Non-map tile used in map layer");
+              }
+              is_first_tile = false;
+            }
+            layer.tiles[count++] = tile;
+            start = next + 1;
           }
-        }
-        // Read the tileset document.
-        tileset.tileset = ultra::sdk::read_tileset(tileset_source.c_str());
-        tilesets.push_back(tileset);
-      } else if (node_name == "layer") {
-        // Parse attributes.
-        Layer layer = {
-          .type = Layer::Type::Image,
-          .parallax = {
-            .x = {1, 1},
-            .y = {1, 1},
-          },
-        };
-        for (auto attr = map_node->first_attribute();
-             attr != nullptr;
-             attr = attr->next_attribute()) {
-          std::string attr_name(attr->name());
-          if (attr_name == "name") {
-            layer.name = ultra::sdk::util::crc32(attr->value());
-          } else if (attr_name == "parallaxx") {
-            layer.parallax.x = double_to_fraction(std::atof(attr->value()));
-          } else if (attr_name == "parallaxy") {
-            layer.parallax.y = double_to_fraction(std::atof(attr->value()));
+          switch (layer.type) {
+          case Layer::Type::Image:
+            layers.push_back(layer);
+            break;
+          case Layer::Type::Bounds:
+            bounds.push_back(layer);
+            break;
           }
         }
-        // Get the layer tile data.
-        layer.tiles = std::vector<uint16_t>(w * h);
-        for (auto layer_node = map_node->first_node();
-             layer_node != nullptr;
-             layer_node = layer_node->next_sibling()) {
-          std::string node_name(layer_node->name());
-          if (node_name == "data") {
-            std::string data(layer_node->value());
-            size_t count = 0;
-            size_t start = 0;
-            size_t next = 0;
-            bool is_first_tile = true;
-            while (next != std::string::npos) {
-              next = data.find(",", start);
-              uint16_t tile = std::atoi(
-                data.substr(start, next - start).c_str()
-              );
+      }
+      layer_index++;
+    } else if (node_name == "objectgroup") {
+      uint32_t layer_name;
+      for (auto attr = map_node->first_attribute();
+           attr != nullptr;
+           attr = attr->next_attribute()) {
+        std::string attr_name(attr->name());
+        if (attr_name == "name") {
+          layer_name = ultra::sdk::util::crc32(attr->value(), names);
+        }
+      }
+      // Parse nodes for entities.
+      for (auto objectgroup_node = map_node->first_node();
+           objectgroup_node != nullptr;
+           objectgroup_node = objectgroup_node->next_sibling()) {
+        std::string node_name(objectgroup_node->name());
+        if (node_name == "object") {
+          Entity ent = {
+            .layer_name = layer_name,
+            .state = 0,
+          };
+          // Parse attributes for gid and position.
+          for (auto attr = objectgroup_node->first_attribute();
+               attr != nullptr;
+               attr = attr->next_attribute()) {
+            std::string attr_name(attr->name());
+            if (attr_name == "gid") {
+              uint32_t tile = std::atoi(attr->value());
+              uint16_t tile_state = 0;
+              if (tile & FLIP_X) {
+                tile ^= FLIP_X;
+                tile_state |= 0x800;
+              }
+              if (tile & FLIP_Y) {
+                tile ^= FLIP_Y;
+                tile_state |= 0x400;
+              }
               if (tile) {
-                // Adjust tile value so its first nybble is the tileset index.
+                // Adjust tile value so its first nybble is the tileset
+                // index.
                 bool found = false;
                 for (int i = tilesets.size() - 1; i >= 0; i--) {
                   if (tile >= tilesets[i].first_gid) {
-                    int index;
-                    if (tilesets[i].tileset.bounds) {
-                      if (!is_first_tile
-                          && layer.type != Layer::Type::Bounds) {
-                        throw std::runtime_error(
-                          "Image layer contains bounds tiles"
-                        );
-                      }
-                      layer.type = Layer::Type::Bounds;
-                      index = 0;
-                    } else {
-                      if (layer.type == Layer::Type::Bounds) {
-                        throw std::runtime_error(
-                          "Bounds layer contains image tiles"
-                        );
-                      }
-                      if (tilesets[i].map_index == -1) {
-                        tilesets[i].map_index = map_tileset_index++;
-                      }
-                      index = tilesets[i].map_index;
+                    if (tilesets[i].entity_index == -1) {
+                      tilesets[i].entity_index = entity_tileset_index++;
                     }
-                    tile = (index << 12) | (tile - tilesets[i].first_gid + 1);
+                    ent.tile = (tilesets[i].entity_index << 12)
+                      | tile_state
+                      | (tile - tilesets[i].first_gid + 1);
+                    ent.w = tilesets[i].tileset->tile_w;
+                    ent.h = tilesets[i].tileset->tile_h;
                     found = true;
                     break;
                   }
                 }
                 if (!found) {
-                  throw std::runtime_error("Non-map tile used in map layer");
+                  throw std::runtime_error(
+                    "Non-entity tile used in entities layer"
+                  );
                 }
-                is_first_tile = false;
               }
-              layer.tiles[count++] = tile;
-              start = next + 1;
+            } else if (attr_name == "x") {
+              ent.x = std::atoi(attr->value());
+            } else if (attr_name == "y") {
+              ent.y = std::atoi(attr->value());
             }
-            switch (layer.type) {
-            case Layer::Type::Image:
-              layers.push_back(layer);
-              break;
-            case Layer::Type::Bounds:
-              bounds.push_back(layer);
-              break;
-            }
-          }
-        }
-        layer_index++;
-      } else if (node_name == "objectgroup") {
-        uint32_t layer_name;
-        for (auto attr = map_node->first_attribute();
-             attr != nullptr;
-             attr = attr->next_attribute()) {
-          std::string attr_name(attr->name());
-          if (attr_name == "name") {
-            layer_name = ultra::sdk::util::crc32(attr->value());
           }
-        }
-        // Parse nodes for entities.
-        for (auto objectgroup_node = map_node->first_node();
-             objectgroup_node != nullptr;
-             objectgroup_node = objectgroup_node->next_sibling()) {
-          std::string node_name(objectgroup_node->name());
-          if (node_name == "object") {
-            Entity ent = {
-              .layer_name = layer_name,
-              .state = 0,
-            };
-            // Parse attributes for gid and position.
-            for (auto attr = objectgroup_node->first_attribute();
-                 attr != nullptr;
-                 attr = attr->next_attribute()) {
-              std::string attr_name(attr->name());
-              if (attr_name == "gid") {
-                uint32_t tile = std::atoi(attr->value());
-                uint16_t tile_state = 0;
-                if (tile & FLIP_X) {
-                  tile ^= FLIP_X;
-                  tile_state |= 0x800;
-                }
-                if (tile & FLIP_Y) {
-                  tile ^= FLIP_Y;
-                  tile_state |= 0x400;
-                }
-                if (tile) {
-                  // Adjust tile value so its first nybble is the tileset
-                  // index.
-                  bool found = false;
-                  for (int i = tilesets.size() - 1; i >= 0; i--) {
-                    if (tile >= tilesets[i].first_gid) {
-                      if (tilesets[i].entity_index == -1) {
-                        tilesets[i].entity_index = entity_tileset_index++;
-                      }
-                      ent.tile = (tilesets[i].entity_index << 12)
-                        | tile_state
-                        | (tile - tilesets[i].first_gid + 1);
-                      ent.w = tilesets[i].tileset.tile_w;
-                      ent.h = tilesets[i].tileset.tile_h;
-                      found = true;
-                      break;
+          // Parse nodes for properties.
+          for (auto object_node = objectgroup_node->first_node();
+               object_node != nullptr;
+               object_node = object_node->next_sibling()) {
+            std::string node_name(object_node->name());
+            if (node_name == "properties") {
+              for (auto properties_node = object_node->first_node();
+                   properties_node != nullptr;
+                   properties_node = properties_node->next_sibling()) {
+                std::string node_name(properties_node->name());
+                if (node_name == "property") {
+                  // Parse attributes for gid and position.
+                  std::string name;
+                  std::string type = "string";
+                  std::string value;
+                  for (auto attr = properties_node->first_attribute();
+                       attr != nullptr;
+                       attr = attr->next_attribute()) {
+                    std::string attr_name(attr->name());
+                    std::string attr_value(attr->value());
+                    if (attr_name == "name") {
+                      name = attr_value;
+                    } else if (attr_name == "type") {
+                      type = attr_value;
+                    } else if (attr_name == "value") {
+                      value = attr_value;
                     }
                   }
-                  if (!found) {
-                    throw std::runtime_error(
-                      "Non-entity tile used in entities layer"
-                    );
-                  }
-                }
-              } else if (attr_name == "x") {
-                ent.x = std::atoi(attr->value());
-              } else if (attr_name == "y") {
-                ent.y = std::atoi(attr->value());
-              }
-            }
-            // Parse nodes for properties.
-            for (auto object_node = objectgroup_node->first_node();
-                 object_node != nullptr;
-                 object_node = object_node->next_sibling()) {
-              std::string node_name(object_node->name());
-              if (node_name == "properties") {
-                for (auto properties_node = object_node->first_node();
-                     properties_node != nullptr;
-                     properties_node = properties_node->next_sibling()) {
-                  std::string node_name(properties_node->name());
-                  if (node_name == "property") {
-                    // Parse attributes for gid and position.
-                    std::string name;
-                    std::string type = "string";
-                    std::string value;
-                    for (auto attr = properties_node->first_attribute();
-                         attr != nullptr;
-                         attr = attr->next_attribute()) {
-                      std::string attr_name(attr->name());
-                      std::string attr_value(attr->value());
-                      if (attr_name == "name") {
-                        name = attr_value;
-                      } else if (attr_name == "type") {
-                        type = attr_value;
-                      } else if (attr_name == "value") {
-                        value = attr_value;
-                      }
-                    }
-                    if (name == "state") {
-                      if (type == "string") {
-                        ent.state = ultra::sdk::util::crc32(value.c_str());
-                      } else if (type == "int") {
-                        ent.state = std::atoi(value.c_str());
-                      } else if (type == "bool") {
-                        if (value == "true") {
-                          ent.state = 1;
-                        } else {
-                          ent.state = 0;
-                        }
-                      } else {
-                        throw std::runtime_error(
-                          "Entity state not type string or int"
+                  if (name == "state") {
+                    if (type == "string") {
+                      ent.state = ultra::sdk::util::crc32(
+                          value.c_str(),
+                          names
                         );
+                    } else if (type == "int") {
+                      ent.state = std::atoi(value.c_str());
+                    } else if (type == "bool") {
+                      if (value == "true") {
+                        ent.state = 1;
+                      } else {
+                        ent.state = 0;
                       }
-                    } else if (name == "type") {
-                      ent.type = value;
+                    } else {
+                      throw std::runtime_error(
+                        "Entity state not type string or int"
+                      );
                     }
+                  } else if (name == "type") {
+                    ent.type = value;
                   }
                 }
               }
             }
-            entities.push_back(ent);
           }
+          entities.push_back(ent);
         }
       }
     }
-    // Sort the tilesets by index.
-    std::vector<Tileset> map_tilesets(tilesets);
-    std::sort(map_tilesets.begin(), map_tilesets.end(), [](
-      Tileset& a,
-      Tileset& b
-    ) {
-      return a.map_index < b.map_index;
-    });
-    while (map_tilesets.size() && map_tilesets[0].map_index == -1) {
-      map_tilesets.erase(map_tilesets.begin());
-    }
-    std::vector<Tileset> entity_tilesets(tilesets);
-    std::sort(entity_tilesets.begin(), entity_tilesets.end(), [](
-      Tileset& a,
-      Tileset& b
-    ) {
-      return a.entity_index < b.entity_index;
-    });
-    while (entity_tilesets.size() && entity_tilesets[0].entity_index == -1) {
-      entity_tilesets.erase(entity_tilesets.begin());
-    }
-    // Add map struct to collection.
-    maps.push_back({
-      .x = static_cast<int16_t>(world["maps"][i]["x"].asInt() / 16),
-      .y = static_cast<int16_t>(world["maps"][i]["y"].asInt() / 16),
-      .w = w,
-      .h = h,
-      .properties = properties,
-      .entities_index = static_cast<uint8_t>(entities_layer_index),
-      .map_tilesets = map_tilesets,
-      .entity_tilesets = entity_tilesets,
-      .layers = layers,
-      .entities = entities,
-    });
   }
-  // Build boundary data.
-  auto points = points_from_bounds(maps, bounds);
+  // Sort the tilesets by index.
+  std::vector<Tileset> map_tilesets(tilesets);
+  std::sort(map_tilesets.begin(), map_tilesets.end(), [](
+    Tileset& a,
+    Tileset& b
+  ) {
+    return a.map_index < b.map_index;
+  });
+  while (map_tilesets.size() && map_tilesets[0].map_index == -1) {
+    map_tilesets.erase(map_tilesets.begin());
+  }
+  std::vector<Tileset> entity_tilesets(tilesets);
+  std::sort(entity_tilesets.begin(), entity_tilesets.end(), [](
+    Tileset& a,
+    Tileset& b
+  ) {
+    return a.entity_index < b.entity_index;
+  });
+  while (entity_tilesets.size() && entity_tilesets[0].entity_index == -1) {
+    entity_tilesets.erase(entity_tilesets.begin());
+  }
+  // Include names from the tilesets used.
+  for (const auto& tileset : map_tilesets) {
+    ultra::sdk::util::merge_names(names, tileset.tileset->names);
+  }
+  for (const auto& tileset : entity_tilesets) {
+    ultra::sdk::util::merge_names(names, tileset.tileset->names);
+  }
+  return {
+    .x = x,
+    .y = y,
+    .w = w,
+    .h = h,
+    .properties = properties,
+    .entities_index = static_cast<uint8_t>(entities_layer_index),
+    .map_tilesets = map_tilesets,
+    .entity_tilesets = entity_tilesets,
+    .layers = layers,
+    .entities = entities,
+    .names = names,
+  };
+}
+
+// Read the world's maps, returning how many had to be parsed.
+static size_t read_maps(
+  const Json::Value& world,
+  const std::string& prefix,
+  unsigned jobs,
+  const std::string& config_data,
+  MapCache& cache,
+  std::vector<Map>& maps,
+  std::vector<Layer>& bounds
+) {
+  const auto& world_maps = world["maps"];
+  size_t count = world_maps.size();
+  std::vector<Map> map_results(count);
+  std::vector<std::vector<Layer>> bounds_results(count);
+  std::vector<std::exception_ptr> errors(count);
+  std::vector<std::vector<std::string>> inputs(count);
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> parsed(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      const auto& world_map = world_maps[static_cast<Json::ArrayIndex>(i)];
+      try {
+        auto path = prefix + world_map["fileName"].asString();
+        auto x = static_cast<int16_t>(world_map["x"].asInt() / 16);
+        auto y = static_cast<int16_t>(world_map["y"].asInt() / 16);
+        std::string key;
+        if (cache.resident || !cache.dir.empty()) {
+          key = map_cache_key(path, prefix, x, y, config_data, inputs[i]);
+        }
+        // Reuse a map kept in memory.
+        auto resident = cache.maps.find(key);
+        if (resident != cache.maps.end()) {
+          map_results[i] = resident->second.map;
+          bounds_results[i] = resident->second.bounds;
+          continue;
+        }
+        // Reuse a map if both of its artifacts were written.
+        auto artifact = cache.dir + "/" + key;
+        if (!cache.dir.empty()
+            && std::filesystem::exists(artifact + ".model")
+            && std::filesystem::exists(artifact + ".bin")) {
+          map_results[i] = load_map_model(
+            artifact + ".model",
+            bounds_results[i]
+          );
+          map_results[i].key = key;
+          continue;
+        }
+        map_results[i] = read_map(
+          path.c_str(),
+          prefix,
+          x,
+          y,
+          bounds_results[i]
+        );
+        map_results[i].key = key;
+        map_results[i].tile_usage = get_tile_usage(map_results[i]);
+        parsed++;
+        if (!cache.dir.empty()) {
+          save_map_model(
+            map_results[i],
+            bounds_results[i],
+            artifact + ".model"
+          );
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+  // Parse maps on the worker threads and the calling thread.
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs && i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Collect results in their original order, keeping only the maps still in
+  // the world resident.
+  std::unordered_map<std::string, ResidentMap> resident;
+  cache.inputs.clear();
+  for (size_t i = 0; i < count; i++) {
+    cache.inputs.insert(inputs[i].begin(), inputs[i].end());
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+    if (cache.resident && !resident.count(map_results[i].key)) {
+      auto it = cache.maps.find(map_results[i].key);
+      if (it != cache.maps.end()) {
+        resident.insert(std::move(*it));
+      } else {
+        resident[map_results[i].key] = {map_results[i], bounds_results[i]};
+      }
+    }
+    maps.push_back(std::move(map_results[i]));
+    std::move(
+      bounds_results[i].begin(),
+      bounds_results[i].end(),
+      std::back_inserter(bounds)
+    );
+  }
+  cache.maps = std::move(resident);
+  return parsed;
+}
+
+static uint64_t hash_bounds(
+  const std::vector<Map>& maps,
+  const std::vector<Layer>& bounds
+) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const auto& map : maps) {
+    hash = hash_field(
+      hash,
+      std::to_string(map.x) + "," + std::to_string(map.y) + ","
+        + std::to_string(map.w) + "," + std::to_string(map.h)
+    );
+  }
+  for (const auto& layer : bounds) {
+    hash = hash_bytes(
+      hash,
+      layer.tiles.data(),
+      layer.tiles.size() * sizeof(uint16_t)
+    );
+  }
+  return hash;
+}
+
+struct Options {
+  const char* world_path;
+  const char* output_path;
+  const char* config_path;
+  const char* header_path;
+  unsigned jobs;
+};
+
+static std::string get_prefix(const std::string& path) {
+  auto prefix = path.substr(0, path.rfind("/"));
+  if (prefix == path) {
+    prefix = ".";
+  }
+  return prefix + "/";
+}
+
+// Compile the world, returning how many maps had to be parsed.
+static size_t build_world(const Options& options, MapCache& cache) {
+  YAML::Node config;
+  std::string config_data;
+  if (options.config_path != nullptr) {
+    config = YAML::LoadFile(options.config_path);
+    config_data = read_file(options.config_path);
+  }
+  check_config(config);
+  auto prefix = get_prefix(options.world_path);
+  auto world = load_json(options.world_path);
+  // Parse maps, reusing cached ones.
+  if (!cache.dir.empty()) {
+    std::filesystem::create_directories(cache.dir);
+  }
+  std::vector<Map> maps;
+  std::vector<Layer> bounds;
+  auto parsed = read_maps(
+    world,
+    prefix,
+    options.jobs,
+    config_data,
+    cache,
+    maps,
+    bounds
+  );
+  // Write the name header.
+  if (options.header_path != nullptr) {
+    ultra::sdk::util::HashMap<std::string> names;
+    for (const auto& map : maps) {
+      ultra::sdk::util::merge_names(names, map.names);
+    }
+    ultra::sdk::util::write_names_header(names, options.header_path);
+  }
+  // Build boundary data, unless the daemon has it for the same bounds.
+  auto key = cache.resident ? hash_bounds(maps, bounds) : 0;
+  if (!cache.resident || cache.bounds_key != key || cache.boundaries.empty()) {
+    cache.boundaries = points_from_bounds(maps, bounds);
+    cache.bounds_key = key;
+  }
+  const auto& points = cache.boundaries;
   if (getenv("PRINT_BOUNDS") != nullptr) {
     size_t points_size1 = points.size();
     size_t count1 = 0;
@@ -1743,16 +3093,164 @@ int main(int argc, const char* argv[]) {
     }
     std::cout << "]";
   }
-  // Build binary data.
-  size_t buf_size;
-  write_world(maps, points, config, nullptr, &buf_size);
-  uint8_t buf[buf_size];
-  write_world(maps, points, config, buf, nullptr);
-  // Write the binary data.
-  std::ofstream out(argv[out_arg_idx]);
-  if (!out.is_open()) {
-    throw std::runtime_error("Could not open output file");
-  }
-  out.write(reinterpret_cast<char*>(buf), buf_size);
+  // Classify bounds tiles for tile-granular collision.
+  std::vector<CollisionGrid> collision;
+  const auto& collision_grid = config["collision_grid"];
+  if (collision_grid.IsDefined()) {
+    collision = collision_grids(
+      maps,
+      bounds,
+      collision_grid["bits"].as<unsigned>(2)
+    );
+  }
+  // Tabulate tile shape heights for ground snapping.
+  HeightTables heights;
+  if (config["height_tables"].as<bool>(false)) {
+    heights = height_tables(maps, bounds);
+  }
+  // Build and write the binary data, replacing the output only once it is
+  // complete.
+  write_artifact(options.output_path, [&](ultra::sdk::Writer& writer) {
+    write_world(maps, points, collision, heights, config, cache, writer);
+  });
+  return parsed;
+}
+
+// Build the world, describing the result in one line.
+static std::string try_build_world(const Options& options, MapCache& cache) {
+  auto start = std::chrono::steady_clock::now();
+  try {
+    auto parsed = build_world(options, cache);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start
+    ).count();
+    return "ok " + std::to_string(parsed) + " maps parsed in "
+      + std::to_string(ms) + " ms";
+  } catch (const std::exception& e) {
+    return std::string("error ") + e.what();
+  }
+}
+
+// Keep maps and tilesets in memory, rebuilding when inputs change and on
+// request.
+static void run_daemon(
+  const Options& options,
+  MapCache& cache,
+  const char* socket_path
+) {
+  cache.resident = true;
+  std::cerr << try_build_world(options, cache) << std::endl;
+  ultra::sdk::Daemon daemon(socket_path);
+  daemon.watch(std::filesystem::absolute(options.world_path).parent_path());
+  std::filesystem::path config_path;
+  if (options.config_path != nullptr) {
+    config_path = std::filesystem::absolute(options.config_path);
+    daemon.watch(config_path.parent_path());
+  }
+  // Watch the directories of the maps and tilesets the last build read,
+  // which may lie outside the world's directory.
+  auto watch_inputs = [&]() {
+    for (const auto& input : cache.inputs) {
+      auto dir = std::filesystem::absolute(input).lexically_normal()
+        .parent_path();
+      if (std::filesystem::is_directory(dir)) {
+        daemon.watch(dir);
+      }
+    }
+  };
+  auto rebuild = [&]() {
+    auto result = try_build_world(options, cache);
+    watch_inputs();
+    return result;
+  };
+  watch_inputs();
+  daemon.run(
+    [&](const std::string& request) -> std::string {
+      if (request == "build") {
+        return rebuild();
+      } else if (request == "stop") {
+        daemon.stop();
+        return "ok";
+      }
+      return "error Unknown request";
+    },
+    [&](const std::vector<std::string>& paths) {
+      // Ignore changes to outputs so that writing them doesn't rebuild.
+      for (const auto& path : paths) {
+        auto extension = std::filesystem::path(path).extension();
+        if (extension == ".world" || extension == ".tmx"
+            || extension == ".tsx"
+            || std::filesystem::absolute(path) == config_path) {
+          std::cerr << rebuild() << std::endl;
+          return;
+        }
+      }
+    }
+  );
+}
+
+static void print_usage(const char* self, std::ostream& out) {
+  out << "Usage: " << self
+      << " [-h] [-c config.yaml] [-j jobs] [-H names.h] [-C cache_dir]"
+      << " [-d socket] <in.world> <out.bin>" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+  // Check for help option.
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      print_usage(argv[0], std::cout);
+      return 0;
+    }
+  }
+  // Check for entity configuration file, job count, cache directory and
+  // daemon socket.
+  Options options = {
+    .config_path = nullptr,
+    .header_path = nullptr,
+    .jobs = 1,
+  };
+  MapCache cache = {};
+  const char* socket_path = nullptr;
+  std::vector<const char*> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-c" && i + 1 < argc) {
+      options.config_path = argv[++i];
+    } else if (arg == "-j" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 0) {
+        print_usage(argv[0], std::cerr);
+        return 1;
+      }
+      // Zero runs one job per hardware thread.
+      options.jobs = value
+        ? value
+        : std::max(1u, std::thread::hardware_concurrency());
+    } else if (arg == "-H" && i + 1 < argc) {
+      options.header_path = argv[++i];
+    } else if (arg == "-C" && i + 1 < argc) {
+      cache.dir = argv[++i];
+    } else if (arg == "-d" && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      print_usage(argv[0], std::cerr);
+      return 1;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  if (args.size() != 2) {
+    print_usage(argv[0], std::cerr);
+    return 1;
+  }
+  options.world_path = args[0];
+  options.output_path = args[1];
+  if (socket_path != nullptr) {
+    run_daemon(options, cache, socket_path);
+  } else {
+    build_world(options, cache);
+  }
   return 0;
 }
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <ultra240-sdk/bvh.h>
+
+namespace ultra::sdk {
+
+  static_assert(sizeof(BvhNode) == 12);
+
+  static_assert(sizeof(BvhSegment) == 20);
+
+  static const size_t max_leaf_size = 0xff;
+
+  static const size_t max_index = 0xffffff;
+
+  static BvhBox get_bounds(const BvhSegment* segments, size_t count) {
+    BvhBox box = {
+      std::numeric_limits<int32_t>::max(),
+      std::numeric_limits<int32_t>::max(),
+      std::numeric_limits<int32_t>::min(),
+      std::numeric_limits<int32_t>::min(),
+    };
+    for (size_t i = 0; i < count; i++) {
+      const auto& segment = segments[i];
+      box.min_x = std::min({box.min_x, segment.x0, segment.x1});
+      box.min_y = std::min({box.min_y, segment.y0, segment.y1});
+      box.max_x = std::max({box.max_x, segment.x0, segment.x1});
+      box.max_y = std::max({box.max_y, segment.y0, segment.y1});
+    }
+    return box;
+  }
+
+  // Quantize a minimum down and a maximum up within a parent's range, so
+  // that the decoded bounds contain the original.
+  static uint16_t quantize_min(int32_t min, int32_t parent_min, int64_t range) {
+    if (range == 0) {
+      return 0;
+    }
+    return (static_cast<int64_t>(min) - parent_min) * 0xffff / range;
+  }
+
+  static uint16_t quantize_max(int32_t max, int32_t parent_min, int64_t range) {
+    if (range == 0) {
+      return 0;
+    }
+    return (
+      (static_cast<int64_t>(max) - parent_min) * 0xffff + range - 1
+    ) / range;
+  }
+
+  // Build the subtree over count segments depth first into nodes.
+  static void build(
+    BvhSegment* segments,
+    size_t first,
+    size_t count,
+    size_t leaf_size,
+    const BvhBox& parent,
+    std::vector<BvhNode>& nodes
+  ) {
+    auto box = get_bounds(segments + first, count);
+    int64_t w = static_cast<int64_t>(parent.max_x) - parent.min_x;
+    int64_t h = static_cast<int64_t>(parent.max_y) - parent.min_y;
+    BvhNode node = {
+      quantize_min(box.min_x, parent.min_x, w),
+      quantize_min(box.min_y, parent.min_y, h),
+      quantize_max(box.max_x, parent.min_x, w),
+      quantize_max(box.max_y, parent.min_y, h),
+      0,
+    };
+    size_t index = nodes.size();
+    if (index > max_index) {
+      throw std::runtime_error("Too many boundary segments");
+    }
+    if (count <= leaf_size) {
+      node.data = count << 24 | first;
+      nodes.push_back(node);
+      return;
+    }
+    nodes.push_back(node);
+    // Split the segments at the median of their centers along the longer
+    // axis of the node.
+    auto bounds = decode_bvh_box(parent, node);
+    bool split_x = box.max_x - box.min_x >= box.max_y - box.min_y;
+    size_t half = count / 2;
+    std::nth_element(
+      segments + first,
+      segments + first + half,
+      segments + first + count,
+      [&](const BvhSegment& a, const BvhSegment& b) {
+        if (split_x) {
+          return static_cast<int64_t>(a.x0) + a.x1
+            < static_cast<int64_t>(b.x0) + b.x1;
+        }
+        return static_cast<int64_t>(a.y0) + a.y1
+          < static_cast<int64_t>(b.y0) + b.y1;
+      }
+    );
+    build(segments, first, half, leaf_size, bounds, nodes);
+    nodes[index].data = nodes.size();
+    build(segments, first + half, count - half, leaf_size, bounds, nodes);
+  }
+
+  void write_bvh(
+    std::vector<BvhSegment> segments,
+    size_t leaf_size,
+    Writer& writer
+  ) {
+    if (leaf_size == 0 || leaf_size > max_leaf_size) {
+      throw std::runtime_error("BVH leaves must hold 1 to 255 segments");
+    }
+    if (segments.size() > max_index) {
+      throw std::runtime_error("Too many boundary segments");
+    }
+    BvhBox root = {};
+    std::vector<BvhNode> nodes;
+    if (!segments.empty()) {
+      root = get_bounds(segments.data(), segments.size());
+      build(segments.data(), 0, segments.size(), leaf_size, root, nodes);
+    }
+    writer.write<int32_t>(root.min_x);
+    writer.write<int32_t>(root.min_y);
+    writer.write<int32_t>(root.max_x);
+    writer.write<int32_t>(root.max_y);
+    writer.write<uint32_t>(nodes.size());
+    writer.write<uint32_t>(segments.size());
+    for (const auto& node : nodes) {
+      writer.write<uint16_t>(node.min_x);
+      writer.write<uint16_t>(node.min_y);
+      writer.write<uint16_t>(node.max_x);
+      writer.write<uint16_t>(node.max_y);
+      writer.write<uint32_t>(node.data);
+    }
+    for (const auto& segment : segments) {
+      writer.write<int32_t>(segment.x0);
+      writer.write<int32_t>(segment.y0);
+      writer.write<int32_t>(segment.x1);
+      writer.write<int32_t>(segment.y1);
+      writer.write<uint16_t>(segment.boundary);
+      writer.write<uint16_t>(segment.point);
+    }
+  }
+
+}
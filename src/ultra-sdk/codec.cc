@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <ultra240-sdk/codec.h>
+#include <unordered_map>
+
+namespace ultra::sdk {
+
+  static const size_t max_literals = 0x80;
+
+  static const size_t max_repeat = 0x3f + 2;
+
+  static const size_t max_distance = 0xffff;
+
+  // Candidate matches checked per tile when compressing.
+  static const size_t max_chain = 64;
+
+  static void push_tile(std::vector<uint8_t>& data, uint16_t tile) {
+    data.push_back(tile & 0xff);
+    data.push_back(tile >> 8);
+  }
+
+  std::vector<uint8_t> compress_tiles(const uint16_t* tiles, size_t count) {
+    std::vector<uint8_t> data;
+    // Earlier positions of each pair of tiles, newest first.
+    std::unordered_map<uint32_t, size_t> heads;
+    std::vector<size_t> chain(count, SIZE_MAX);
+    auto pair_at = [&](size_t i) {
+      return tiles[i] | static_cast<uint32_t>(tiles[i + 1]) << 16;
+    };
+    auto insert = [&](size_t i) {
+      if (i + 1 < count) {
+        auto result = heads.emplace(pair_at(i), i);
+        if (!result.second) {
+          chain[i] = result.first->second;
+          result.first->second = i;
+        }
+      }
+    };
+    size_t literals = 0;
+    auto flush_literals = [&](size_t end) {
+      for (size_t i = end - literals; i < end; ) {
+        size_t n = std::min(end - i, max_literals);
+        data.push_back(n - 1);
+        for (size_t j = 0; j < n; j++) {
+          push_tile(data, tiles[i++]);
+        }
+      }
+      literals = 0;
+    };
+    for (size_t i = 0; i < count; ) {
+      size_t limit = std::min(count - i, max_repeat);
+      // Measure the run of repeated tiles.
+      size_t run = 1;
+      while (run < limit && tiles[i + run] == tiles[i]) {
+        run++;
+      }
+      // Find the longest earlier match.
+      size_t match = 0;
+      size_t distance = 0;
+      if (i + 1 < count) {
+        auto head = heads.find(pair_at(i));
+        size_t j = head == heads.end() ? SIZE_MAX : head->second;
+        for (size_t depth = 0;
+             j != SIZE_MAX && depth < max_chain && i - j <= max_distance;
+             depth++, j = chain[j]) {
+          size_t length = 0;
+          while (length < limit && tiles[j + length] == tiles[i + length]) {
+            length++;
+          }
+          if (length > match) {
+            match = length;
+            distance = i - j;
+          }
+        }
+      }
+      size_t length = 1;
+      if (run >= 2 && run >= match) {
+        flush_literals(i);
+        data.push_back(0x80 | (run - 2));
+        push_tile(data, tiles[i]);
+        length = run;
+      } else if (match >= 2) {
+        flush_literals(i);
+        data.push_back(0xc0 | (match - 2));
+        push_tile(data, distance);
+        length = match;
+      } else {
+        literals++;
+      }
+      for (size_t j = 0; j < length; j++) {
+        insert(i + j);
+      }
+      i += length;
+    }
+    flush_literals(count);
+    return data;
+  }
+
+  size_t decompress_tiles(
+    const uint8_t* data,
+    size_t size,
+    uint16_t* tiles,
+    size_t count
+  ) {
+    size_t in = 0;
+    size_t out = 0;
+    auto read_tile = [&]() {
+      if (size - in < 2) {
+        throw std::runtime_error("Truncated tile data");
+      }
+      uint16_t tile = data[in] | data[in + 1] << 8;
+      in += 2;
+      return tile;
+    };
+    while (out < count) {
+      if (in >= size) {
+        throw std::runtime_error("Truncated tile data");
+      }
+      uint8_t control = data[in++];
+      if (!(control & 0x80)) {
+        size_t n = control + 1;
+        if (n > count - out) {
+          throw std::runtime_error("Corrupt tile data");
+        }
+        for (size_t i = 0; i < n; i++) {
+          tiles[out++] = read_tile();
+        }
+        continue;
+      }
+      size_t n = (control & 0x3f) + 2;
+      if (n > count - out) {
+        throw std::runtime_error("Corrupt tile data");
+      }
+      if (!(control & 0x40)) {
+        std::fill_n(tiles + out, n, read_tile());
+        out += n;
+      } else {
+        size_t distance = read_tile();
+        if (distance == 0 || distance > out) {
+          throw std::runtime_error("Corrupt tile data");
+        }
+        for (size_t i = 0; i < n; i++, out++) {
+          tiles[out] = tiles[out - distance];
+        }
+      }
+    }
+    return in;
+  }
+
+}
@@ -0,0 +1,71 @@
+#include <cstring>
+#include <stdexcept>
+#include <ultra240-sdk/sections.h>
+
+namespace ultra::sdk {
+
+  std::vector<Section> read_sections(const uint8_t* data, size_t size) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    if (size < 8) {
+      throw std::runtime_error("Missing section table");
+    }
+    std::memcpy(&magic, data, sizeof(magic));
+    std::memcpy(&version, data + 4, sizeof(version));
+    std::memcpy(&count, data + 6, sizeof(count));
+    if (magic != section_magic) {
+      throw std::runtime_error("Missing section table");
+    }
+    if (version != section_version) {
+      throw std::runtime_error("Unsupported section table version");
+    }
+    if (count > (size - 8) / 16) {
+      throw std::runtime_error("Truncated section table");
+    }
+    std::vector<Section> sections(count);
+    for (size_t i = 0; i < count; i++) {
+      auto& section = sections[i];
+      std::memcpy(&section, data + 8 + i * 16, sizeof(section));
+      if (section.offset > size || section.size > size - section.offset) {
+        throw std::runtime_error("Truncated section");
+      }
+    }
+    return sections;
+  }
+
+  SectionTable::SectionTable(size_t count, Writer& writer)
+    : writer(&writer),
+      count(count),
+      index(0),
+      start(0) {
+    writer.write<uint32_t>(section_magic);
+    writer.write<uint16_t>(section_version);
+    writer.write<uint16_t>(count);
+    entries = writer.reserve<uint32_t>(count * 4);
+  }
+
+  void SectionTable::begin(SectionType type, SectionFlags flags) {
+    if (index == count) {
+      throw std::logic_error("Too many sections");
+    }
+    if (index > 0) {
+      entries[(index - 1) * 4 + 2].set(writer->offset() - start);
+    }
+    start = writer->offset();
+    entries[index * 4].set(static_cast<uint32_t>(type));
+    entries[index * 4 + 1].set(start);
+    entries[index * 4 + 3].set(static_cast<uint32_t>(flags));
+    index++;
+  }
+
+  void SectionTable::end() {
+    if (index != count) {
+      throw std::logic_error("Missing sections");
+    }
+    if (index > 0) {
+      entries[(index - 1) * 4 + 2].set(writer->offset() - start);
+    }
+  }
+
+}
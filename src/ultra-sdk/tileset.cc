@@ -1,5 +1,10 @@
 #include <cmath>
-#include <queue>
+#include <filesystem>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <ultra240-sdk/tileset.h>
 #include <ultra240-sdk/util.h>
 #include <rapidxml/rapidxml.hpp>
@@ -7,15 +12,14 @@
 
 namespace ultra::sdk {
 
-  Tileset read_tileset(const char* path) {
+  static Tileset parse_tileset(char* data) {
     Tileset tileset = {
       .margin = 0,
       .spacing = 0,
       .bounds = false,
     };
-    rapidxml::file<> file(path);
     rapidxml::xml_document<> tileset_doc;
-    tileset_doc.parse<0>(file.data());
+    tileset_doc.parse<0>(data);
     // Parse attributes for tile dimensions, margin, and spacing.
     for (auto attr = tileset_doc.first_node()->first_attribute();
          attr != nullptr;
@@ -126,7 +130,7 @@ namespace ultra::sdk {
                   }
                 }
                 if (name == "name") {
-                  tile.name = ultra::sdk::util::crc32(value.c_str());
+                  tile.name = util::crc32(value.c_str(), tileset.names);
                 } else if (name == "library") {
                   tile.library = value;
                 }
@@ -148,9 +152,9 @@ namespace ultra::sdk {
                   std::string attr_name(attr->name());
                   if (attr_name == "type") {
                     has_type = true;
-                    type = ultra::sdk::util::crc32(attr->value());
+                    type = util::crc32(attr->value(), tileset.names);
                   } else if (attr_name == "name") {
-                    name = ultra::sdk::util::crc32(attr->value());
+                    name = util::crc32(attr->value(), tileset.names);
                   } else if (attr_name == "x") {
                     cb.x = static_cast<uint16_t>(
                       round(std::atof(attr->value()))
@@ -209,189 +213,188 @@ namespace ultra::sdk {
             }
           }
         }
-        tileset.tiles.insert({tile_id, tile});
+        tileset.tiles.emplace(tile_id, std::move(tile));
       }
     }
     return tileset;
   }
 
-  void write_tileset(
-    const Tileset& tileset,
-    uint8_t* buf,
-    size_t* buf_size,
-    uint32_t** source_offset_entry,
-    std::list<uint32_t*>* tile_offset_entries,
-    uint32_t** library_offset_entry
-  ) {
-    uint8_t* p = buf;
-    uint16_t* tile_count = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    uint16_t* w = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    uint16_t* h = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    if (source_offset_entry != nullptr) {
-      *source_offset_entry = reinterpret_cast<uint32_t*>(p);
+  Tileset read_tileset(const char* path) {
+    rapidxml::file<> file(path);
+    return parse_tileset(file.data());
+  }
+
+  std::shared_ptr<const Tileset> read_shared_tileset(const char* path) {
+    typedef std::shared_future<std::shared_ptr<const Tileset>> Future;
+    struct Entry {
+      std::filesystem::file_time_type time;
+      uintmax_t size;
+      std::string contents;
+      Future tileset;
+    };
+    static std::mutex mutex;
+    static std::unordered_map<std::string, Entry> cache;
+    auto canonical_path = std::filesystem::canonical(path).string();
+    auto time = std::filesystem::last_write_time(canonical_path);
+    auto size = std::filesystem::file_size(canonical_path);
+    // Skip reading the file while its timestamp and size are unchanged.
+    Future future;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = cache.find(canonical_path);
+      if (it != cache.end()
+          && it->second.time == time
+          && it->second.size == size) {
+        future = it->second.tileset;
+      }
     }
-    p += sizeof(uint32_t);
-    if (library_offset_entry != nullptr) {
-      *library_offset_entry = reinterpret_cast<uint32_t*>(p);
+    if (future.valid()) {
+      return future.get();
     }
-    p += sizeof(uint32_t);
-    uint16_t* tile_data_count = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    for (int i = 0; i < tileset.tiles.size(); i++) {
-      if (tile_offset_entries != nullptr) {
-        tile_offset_entries->push_back(reinterpret_cast<uint32_t*>(p));
+    // Reuse the entry for this file if its contents have not changed.
+    // Otherwise claim the entry and parse the file outside the lock.
+    rapidxml::file<> file(canonical_path.c_str());
+    std::string contents(file.data(), file.size());
+    std::promise<std::shared_ptr<const Tileset>> promise;
+    bool found = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = cache.find(canonical_path);
+      if (it != cache.end() && it->second.contents == contents) {
+        it->second.time = time;
+        it->second.size = size;
+        future = it->second.tileset;
+        found = true;
+      } else {
+        future = promise.get_future().share();
+        cache[canonical_path] = {time, size, std::move(contents), future};
       }
-      p += sizeof(uint32_t);
-    }
-    if (buf != nullptr) {
-      *tile_count = tileset.tile_count;
-      *w = tileset.tile_w;
-      *h = tileset.tile_h;
-      *tile_data_count = tileset.tiles.size();
     }
-    if (buf_size != nullptr) {
-      *buf_size = p - buf;
+    if (!found) {
+      try {
+        promise.set_value(
+          std::make_shared<const Tileset>(parse_tileset(file.data()))
+        );
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+      }
     }
+    return future.get();
   }
 
-  struct AnimationTile {
-    uint16_t* tile_id;
-    uint16_t* duration;
-  };
+  TilesetPatches write_tileset(
+    const Tileset& tileset,
+    Writer& writer,
+    bool lookup
+  ) {
+    TilesetPatches patches;
+    writer.write<uint16_t>(tileset.tile_count);
+    writer.write<uint16_t>(tileset.tile_w);
+    writer.write<uint16_t>(tileset.tile_h);
+    patches.source = writer.reserve<uint32_t>();
+    patches.library = writer.reserve<uint32_t>();
+    writer.write<uint16_t>(tileset.tiles.size());
+    patches.tiles = writer.reserve<uint32_t>(tileset.tiles.size());
+    if (lookup) {
+      if (!tileset.tiles.empty()
+          && std::prev(tileset.tiles.end())->first >= tileset.tile_count) {
+        throw std::runtime_error("Tile id outside tileset");
+      }
+      patches.lookup = writer.reserve<uint32_t>(tileset.tile_count);
+    }
+    return patches;
+  }
 
-  void write_tileset_tile(
+  TilesetTilePatches write_tileset_tile(
     uint16_t id,
     const Tileset::Tile& tile,
-    uint8_t* buf,
-    size_t* buf_size,
-    std::list<uint32_t*>* collision_box_type_offset_entries,
-    uint32_t** library_offset_entry
+    Writer& writer,
+    bool shared_animation
   ) {
-    uint8_t* p = buf;
-    uint16_t* tile_id = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    uint32_t* name = reinterpret_cast<uint32_t*>(p);
-    p += sizeof(uint32_t);
-    if (library_offset_entry != nullptr) {
-      *library_offset_entry = reinterpret_cast<uint32_t*>(p);
-    }
-    p += sizeof(uint32_t);
-    uint16_t* collision_box_types_count = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    for (int i = 0; i < tile.collision_boxes.size(); i++) {
-      if (collision_box_type_offset_entries != nullptr) {
-        collision_box_type_offset_entries->push_back(
-          reinterpret_cast<uint32_t*>(p)
-        );
-      }
-      p += sizeof(uint32_t);
+    TilesetTilePatches patches;
+    writer.write<uint16_t>(id);
+    writer.write<uint32_t>(tile.name);
+    patches.library = writer.reserve<uint32_t>();
+    writer.write<uint16_t>(tile.collision_boxes.size());
+    patches.collision_box_types = writer.reserve<uint32_t>(
+      tile.collision_boxes.size()
+    );
+    writer.write<uint8_t>(tile.animation_tiles.size());
+    if (shared_animation) {
+      patches.animation = writer.reserve<uint32_t>();
+    } else {
+      write_tileset_tile_animation(tile.animation_tiles, writer);
     }
-    uint8_t* animation_tile_count = p;
-    p += sizeof(uint8_t);
-    std::queue<AnimationTile> animation_tiles;
-    for (int i = 0; i < tile.animation_tiles.size(); i++) {
-      AnimationTile ptrs;
-      ptrs.tile_id = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      ptrs.duration = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      animation_tiles.push(ptrs);
-    }
-    if (buf != nullptr) {
-      *tile_id = id;
-      *name = tile.name;
-      *collision_box_types_count = tile.collision_boxes.size();
-      *animation_tile_count = tile.animation_tiles.size();
-      for (const auto& tile : tile.animation_tiles) {
-        auto ptrs = animation_tiles.front();
-        animation_tiles.pop();
-        *ptrs.tile_id = tile.tile_id;
-        *ptrs.duration = tile.duration;
-      }
-    }
-    if (buf_size != nullptr) {
-      *buf_size = p - buf;
+    return patches;
+  }
+
+  void write_tileset_tile_animation(
+    const std::vector<Tileset::Tile::AnimationTile>& animation_tiles,
+    Writer& writer
+  ) {
+    for (const auto& animation_tile : animation_tiles) {
+      writer.write<uint16_t>(animation_tile.tile_id);
+      writer.write<uint16_t>(animation_tile.duration);
     }
   }
 
-  void write_tileset_tile_collision_box_type(
+  Writer::Patch<uint32_t> write_tileset_tile_collision_box_type(
     uint32_t type,
     const util::HashMap<std::vector<Tileset::Tile::CollisionBox>>& lists,
-    uint8_t* buf,
-    size_t* buf_size,
-    std::list<uint32_t*>* collision_box_list_offset_entries
+    Writer& writer
   ) {
-    uint8_t* p = buf;
-    uint32_t* collision_box_type = reinterpret_cast<uint32_t*>(p);
-    p += sizeof(uint32_t);
-    uint16_t* collision_box_list_count = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    for (int i = 0; i < lists.size(); i++) {
-      if (collision_box_list_offset_entries != nullptr) {
-        collision_box_list_offset_entries->push_back(
-          reinterpret_cast<uint32_t*>(p)
-        );
-      }
-      p += sizeof(uint32_t);
-    }
-    if (buf != nullptr) {
-      *collision_box_type = type;
-      *collision_box_list_count = lists.size();
-    }
-    if (buf_size != nullptr) {
-      *buf_size = p - buf;
-    }
+    writer.write<uint32_t>(type);
+    writer.write<uint16_t>(lists.size());
+    return writer.reserve<uint32_t>(lists.size());
   }
 
-  struct CollisionBox {
-    uint16_t* x;
-    uint16_t* y;
-    uint16_t* w;
-    uint16_t* h;
-  };
-
   void write_tileset_tile_collision_box_list(
     uint32_t name,
     const std::vector<Tileset::Tile::CollisionBox>& collision_boxes,
-    uint8_t* buf,
-    size_t* buf_size
+    Writer& writer
   ) {
-    uint8_t* p = buf;
-    uint32_t* collision_box_name = reinterpret_cast<uint32_t*>(p);
-    p += sizeof(uint32_t);
-    uint16_t* collision_box_count = reinterpret_cast<uint16_t*>(p);
-    p += sizeof(uint16_t);
-    std::queue<CollisionBox> cb_ptrs;
-    for (int i = 0; i < collision_boxes.size(); i++) {
-      CollisionBox ptrs;
-      ptrs.x = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      ptrs.y = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      ptrs.w = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      ptrs.h = reinterpret_cast<uint16_t*>(p);
-      p += sizeof(uint16_t);
-      cb_ptrs.push(ptrs);
+    writer.write<uint32_t>(name);
+    writer.write<uint16_t>(collision_boxes.size());
+    for (const auto& cb : collision_boxes) {
+      writer.write<uint16_t>(cb.x);
+      writer.write<uint16_t>(cb.y);
+      writer.write<uint16_t>(cb.w);
+      writer.write<uint16_t>(cb.h);
     }
-    if (buf != nullptr) {
-      *collision_box_name = name;
-      *collision_box_count = collision_boxes.size();
-      for (const auto& cb : collision_boxes) {
-        auto ptrs = cb_ptrs.front();
-        cb_ptrs.pop();
-        *ptrs.x = cb.x;
-        *ptrs.y = cb.y;
-        *ptrs.w = cb.w;
-        *ptrs.h = cb.h;
-      }
+  }
+
+  uint32_t write_shared_collision_box_list(
+    uint32_t name,
+    const std::vector<Tileset::Tile::CollisionBox>& collision_boxes,
+    TileDataPool& pool,
+    Writer& writer
+  ) {
+    std::string key(reinterpret_cast<const char*>(&name), sizeof(name));
+    key.append(
+      reinterpret_cast<const char*>(collision_boxes.data()),
+      collision_boxes.size() * sizeof(Tileset::Tile::CollisionBox)
+    );
+    auto result = pool.collision_box_lists.emplace(key, writer.offset());
+    if (result.second) {
+      write_tileset_tile_collision_box_list(name, collision_boxes, writer);
     }
-    if (buf_size != nullptr) {
-      *buf_size = p - buf;
+    return result.first->second;
+  }
+
+  uint32_t write_shared_animation(
+    const std::vector<Tileset::Tile::AnimationTile>& animation_tiles,
+    TileDataPool& pool,
+    Writer& writer
+  ) {
+    std::string key(
+      reinterpret_cast<const char*>(animation_tiles.data()),
+      animation_tiles.size() * sizeof(Tileset::Tile::AnimationTile)
+    );
+    auto result = pool.animations.emplace(key, writer.offset());
+    if (result.second) {
+      write_tileset_tile_animation(animation_tiles, writer);
     }
+    return result.first->second;
   }
 
 }
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <ultra240-sdk/writer.h>
+
+namespace ultra::sdk {
+
+  Writer::Writer() : base(0) {}
+
+  Writer::Writer(const char* path)
+    : base(0),
+      file(new std::ofstream(path, std::ios::binary | std::ios::trunc)) {
+    if (!file->is_open()) {
+      throw std::runtime_error("Could not open output file");
+    }
+  }
+
+  uint32_t Writer::offset() const {
+    return static_cast<uint32_t>(base + buf.size());
+  }
+
+  const uint8_t* Writer::data() const {
+    return buf.data();
+  }
+
+  size_t Writer::size() const {
+    return base + buf.size();
+  }
+
+  void Writer::flush() {
+    if (file == nullptr) {
+      return;
+    }
+    file->write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    file->flush();
+    if (!*file) {
+      throw std::runtime_error("Could not write output file");
+    }
+    base += buf.size();
+    buf.clear();
+  }
+
+  const std::vector<uint32_t>& Writer::relocations() const {
+    return offsets;
+  }
+
+  void Writer::write_string(const std::string& string) {
+    write_bytes(string.c_str(), string.size() + 1);
+  }
+
+  void Writer::write_bytes(const void* data, size_t size) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    buf.insert(buf.end(), bytes, bytes + size);
+  }
+
+  void Writer::patch(size_t offset, const void* data, size_t size) {
+    if (offset + size > base + buf.size()) {
+      throw std::out_of_range("Patch past end of output");
+    }
+    if (offset >= base) {
+      std::memcpy(buf.data() + offset - base, data, size);
+      return;
+    }
+    // Patch bytes that have already been flushed in place.
+    file->seekp(offset);
+    file->write(static_cast<const char*>(data), size);
+    file->seekp(base);
+    if (!*file) {
+      throw std::runtime_error("Could not write output file");
+    }
+  }
+
+  void StringPool::add(size_t position, const std::string& string) {
+    refs[string].push_back(position);
+  }
+
+  uint32_t StringPool::write(Writer& writer) {
+    uint32_t pool_offset = writer.offset();
+    // Sort by reversed contents, so that every string comes right before
+    // the strings it ends, if any.
+    std::vector<const std::string*> strings;
+    strings.reserve(refs.size());
+    for (const auto& pair : refs) {
+      strings.push_back(&pair.first);
+    }
+    std::sort(
+      strings.begin(),
+      strings.end(),
+      [](const std::string* a, const std::string* b) {
+        return std::lexicographical_compare(
+          a->rbegin(),
+          a->rend(),
+          b->rbegin(),
+          b->rend()
+        );
+      }
+    );
+    std::vector<std::pair<size_t, uint32_t>> patches;
+    uint32_t next_offset = 0;
+    for (size_t i = strings.size(); i-- > 0; ) {
+      const auto& string = *strings[i];
+      const auto* next = i + 1 < strings.size() ? strings[i + 1] : nullptr;
+      uint32_t offset;
+      if (next != nullptr
+          && next->size() >= string.size()
+          && next->compare(
+            next->size() - string.size(),
+            string.size(),
+            string
+          ) == 0) {
+        offset = next_offset + next->size() - string.size();
+      } else {
+        offset = writer.offset();
+        writer.write_string(string);
+      }
+      for (auto position : refs[string]) {
+        patches.push_back({position, offset});
+      }
+      next_offset = offset;
+    }
+    // Patch in output order, in case the output has been flushed.
+    std::sort(patches.begin(), patches.end());
+    for (const auto& patch : patches) {
+      writer.patch(patch.first, &patch.second, sizeof(patch.second));
+    }
+    return pool_offset;
+  }
+
+}
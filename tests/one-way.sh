@@ -0,0 +1,11 @@
+#!/bin/sh
+# A one-way run of a single tile is written as a line of two points.
+set -e
+world="${ULTRA_SDK_WORLD:-../src/ultra-sdk-world/ultra-sdk-world}"
+output="one-way.bin"
+trap 'rm -f "$output"' EXIT
+bounds=$(PRINT_BOUNDS=1 "$world" "${srcdir:-.}/one-way/test.world" "$output")
+case "$bounds" in
+  *'[[16,24],[32,24]]'*) ;;
+  *) echo "Unexpected bounds: $bounds" >&2; exit 1 ;;
+esac
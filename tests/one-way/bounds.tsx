@@ -0,0 +1,4 @@
+<?xml version="1.0" encoding="UTF-8"?>
+<tileset version="1.5" name="bounds" tilewidth="16" tileheight="16" tilecount="128" columns="16">
+ <properties><property name="bounds" type="bool" value="true"/></properties>
+</tileset>